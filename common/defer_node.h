@@ -0,0 +1,18 @@
+#ifndef DEFER_NODE_H
+#define DEFER_NODE_H
+
+/*
+ * intrusive hook for objects handed to a reclamation scheme. the scheme
+ * links retired objects through defer_next_ and calls defer_free_ once no
+ * reader can reach them any more, so retiring needs no allocation and no
+ * type-erased callable.
+ */
+struct defer_node
+{
+    defer_node* defer_next_;
+    void (*defer_free_)(defer_node*);
+
+    defer_node() : defer_next_(nullptr), defer_free_(nullptr) {}
+};
+
+#endif /* end of DEFER_NODE_H */
@@ -0,0 +1,69 @@
+#ifndef HIGH_WATERMARK_H
+#define HIGH_WATERMARK_H
+
+#include <atomic>
+#include <cstddef>
+
+/*
+ * optional high-watermark tracker for any queue with size_approx().
+ *
+ * the queues themselves don't track the maximum, that would put a shared
+ * RMW on every enqueue. instead the depth is sampled, either by a monitor
+ * thread calling sample() or by producers calling sample_every<N>(), and
+ * the maximum is only written when a sample raises it. in steady state a
+ * sample is three relaxed loads and a compare.
+ */
+class high_watermark
+{
+public:
+    high_watermark() : max_(0) {}
+
+    high_watermark(high_watermark const&) = delete;
+    void operator = (high_watermark const&) = delete;
+
+    void observe(size_t depth)
+    {
+        size_t max = max_.load(std::memory_order_relaxed);
+        while (depth > max &&
+               !max_.compare_exchange_weak(max, depth, std::memory_order_relaxed)) {
+        }
+    }
+
+    template<typename queue_t>
+    void sample(queue_t const& queue)
+    {
+        observe(queue.size_approx());
+    }
+
+    // samples one call in `period' per `count', for use on the hot path.
+    // the counter is the caller's, one per thread (e.g. a local of the
+    // thread's loop) and per tracker, starting at 0; a counter hidden in
+    // here would be shared by every tracker sampling the same queue type.
+    template<unsigned period, typename queue_t>
+    void sample_every(queue_t const& queue, unsigned& count)
+    {
+        static_assert(period > 0, "bad sample period");
+        if (++count == period) {
+            count = 0;
+            sample(queue);
+        }
+    }
+
+    size_t get() const
+    {
+        return max_.load(std::memory_order_relaxed);
+    }
+
+    // returns the maximum since the previous reset, for periodic reporting.
+    size_t reset()
+    {
+        return max_.exchange(0, std::memory_order_relaxed);
+    }
+
+private:
+    char pad0_[64];
+    std::atomic<size_t> max_;
+    char pad1_[64];
+};
+
+#endif /* end of HIGH_WATERMARK_H */
@@ -0,0 +1,195 @@
+#ifndef NODE_ARENA_H
+#define NODE_ARENA_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <new>
+
+#include "../mpmc_bounded_queue/buffer_allocation.h"
+#include "../proxy_collector/elimination_stack.h"
+
+#if __cplusplus >= 201703L
+#include <memory_resource>
+#endif
+
+/*
+ * node arena on one huge-page backed mapping.
+ *
+ * the arena reserves `bytes' up front through mmap_allocation (huge_tlb
+ * by default, which falls back to transparent huge pages) and carves
+ * blocks from it with a bump pointer, so the nodes of a queue sit densely
+ * in a few 2MiB pages and a consumer walking them takes a handful of TLB
+ * entries instead of one per 4KiB page. freed blocks go to one free list
+ * per 16-byte size class up to max_class_size and are reused before the
+ * bump pointer moves on; bigger blocks are only returned with the arena.
+ * free lists are elimination_stacks (the arena stays mapped), so any
+ * thread may allocate and free. when the reservation runs out allocate
+ * throws std::bad_alloc.
+ *
+ * the arena has to outlive every queue that uses it.
+ */
+class node_arena
+{
+    struct block
+    {
+        std::atomic<block*> next_;
+    };
+
+    static size_t const granule = 16;
+    static size_t const classes = 16;
+
+public:
+    static size_t const max_class_size = granule * classes;
+
+    explicit node_arena(size_t bytes,
+                        unsigned flags = mmap_allocation::huge_tlb)
+        : map_(flags), bytes_(bytes), used_(0)
+    {
+        base_ = static_cast<char*>(map_.allocate(bytes));
+    }
+
+    ~node_arena()
+    {
+        map_.deallocate(base_, bytes_);
+    }
+
+    node_arena(node_arena const&) = delete;
+    void operator = (node_arena const&) = delete;
+
+    void* allocate(size_t bytes, size_t align = alignof(std::max_align_t))
+    {
+        size_t size = round(bytes);
+        if (size <= max_class_size && align <= granule) {
+            if (block* b = free_[size / granule - 1].pop()) {
+                return b;
+            }
+        }
+        // align is a power of two; blocks already start on a granule.
+        size_t pad = align > granule ? align - granule : 0;
+        size_t at = used_.fetch_add(size + pad, std::memory_order_relaxed);
+        if (at + size + pad > bytes_) {
+            used_.fetch_sub(size + pad, std::memory_order_relaxed);
+            throw std::bad_alloc();
+        }
+        uintptr_t p = (uintptr_t)(base_ + at);
+        return reinterpret_cast<void*>((p + align - 1) & ~(uintptr_t)(align - 1));
+    }
+
+    void deallocate(void* p, size_t bytes, size_t align = alignof(std::max_align_t))
+    {
+        size_t size = round(bytes);
+        if (size <= max_class_size && align <= granule) {
+            free_[size / granule - 1].push(static_cast<block*>(p));
+        }
+    }
+
+    // bytes carved so far, what the arena has touched at most.
+    size_t used() const
+    {
+        return used_.load(std::memory_order_relaxed);
+    }
+
+    size_t capacity() const
+    {
+        return bytes_;
+    }
+
+    // what the mapping actually got (mmap_allocation flags).
+    unsigned used_flags() const
+    {
+        return map_.used_flags();
+    }
+
+private:
+    mmap_allocation map_;
+    char* base_;
+    size_t const bytes_;
+    std::atomic<size_t> used_;
+    elimination_stack<block, 0> free_[classes];
+
+    static size_t round(size_t bytes)
+    {
+        if (bytes < sizeof(block)) {
+            bytes = sizeof(block);
+        }
+        return (bytes + granule - 1) & ~(granule - 1);
+    }
+};
+
+
+/*
+ * std::allocator-compatible handle to a node_arena. it is stateful,
+ * copies and rebinds share the arena.
+ */
+template<typename T>
+class arena_allocator
+{
+    template<typename U> friend class arena_allocator;
+    node_arena* arena_;
+
+public:
+    typedef T value_type;
+
+    explicit arena_allocator(node_arena& arena) : arena_(&arena) {}
+
+    template<typename U>
+    arena_allocator(arena_allocator<U> const& other) : arena_(other.arena_) {}
+
+    T* allocate(size_t n)
+    {
+        return static_cast<T*>(arena_->allocate(n * sizeof(T), alignof(T)));
+    }
+
+    void deallocate(T* p, size_t n)
+    {
+        arena_->deallocate(p, n * sizeof(T), alignof(T));
+    }
+
+    node_arena& arena() const
+    {
+        return *arena_;
+    }
+};
+
+template<typename T, typename U>
+bool operator == (arena_allocator<T> const& a, arena_allocator<U> const& b)
+{
+    return &a.arena() == &b.arena();
+}
+
+template<typename T, typename U>
+bool operator != (arena_allocator<T> const& a, arena_allocator<U> const& b)
+{
+    return !(a == b);
+}
+
+
+#if __cplusplus >= 201703L
+// the arena as a pmr resource, for std::pmr::polymorphic_allocator.
+class arena_resource : public std::pmr::memory_resource
+{
+    node_arena& arena_;
+
+public:
+    explicit arena_resource(node_arena& arena) : arena_(arena) {}
+
+private:
+    void* do_allocate(size_t bytes, size_t align) override
+    {
+        return arena_.allocate(bytes, align);
+    }
+
+    void do_deallocate(void* p, size_t bytes, size_t align) override
+    {
+        arena_.deallocate(p, bytes, align);
+    }
+
+    bool do_is_equal(std::pmr::memory_resource const& other) const noexcept override
+    {
+        return this == &other;
+    }
+};
+#endif
+
+#endif /* end of NODE_ARENA_H */
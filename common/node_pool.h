@@ -0,0 +1,291 @@
+#ifndef NODE_POOL_H
+#define NODE_POOL_H
+
+#include <atomic>
+#include <cstddef>
+#include <new>
+
+#include "../proxy_collector/elimination_stack.h"
+
+/*
+ * shared pool of fixed-size blocks for queue nodes.
+ *
+ * every thread keeps a loaded magazine of up to T_magazine blocks and a
+ * spare one that is either empty or full. allocate and deallocate only
+ * touch the calling thread's magazines. a thread that frees more than it
+ * allocates (the consumer of an mpsc queue) spills full magazines to a
+ * global depot, and a thread that allocates more (its producers) refills
+ * from there, so nodes go back to the threads that need them without
+ * passing through malloc. the depot is an elimination_stack of whole
+ * magazines, moving T_magazine blocks costs one CAS. the spare keeps a
+ * thread that alternates allocate and deallocate at a magazine boundary
+ * from going to the depot every time.
+ *
+ * blocks are carved from chunks of one magazine each. chunks are never
+ * returned: elimination_stack needs its nodes to stay mapped (a pop may
+ * read the first word of a block another thread has just taken, the tagged
+ * CAS then throws the value away), and an immortal pool is also safe to
+ * use from static destructors. what a thread still holds when it exits
+ * goes back to the depot, a partial magazine to a list of loose blocks
+ * that the next refill sorts back into magazines.
+ */
+template<size_t T_size, size_t T_magazine = 64>
+class node_pool
+{
+    static_assert(T_magazine > 0, "a magazine holds at least one block");
+
+    struct block
+    {
+        std::atomic<block*> next_; // depot / loose list link
+        block* link_;              // next block in the same magazine
+    };
+
+    static size_t const align = alignof(std::max_align_t);
+    static size_t const raw_size = T_size > sizeof(block) ? T_size : sizeof(block);
+
+public:
+    static size_t const block_size = (raw_size + align - 1) / align * align;
+
+private:
+    elimination_stack<block> depot_; // full magazines
+    elimination_stack<block> loose_; // single blocks, linked through next_
+    std::atomic<size_t> chunks_;
+
+    struct cache
+    {
+        block* loaded_;
+        size_t loaded_count_;
+        block* spare_;
+        size_t spare_count_;
+
+        cache() : loaded_(nullptr), loaded_count_(0), spare_(nullptr), spare_count_(0) {}
+
+        ~cache()
+        {
+            node_pool& p = get();
+            if (spare_count_) {
+                p.depot_.push(spare_);
+            }
+            if (loaded_count_ == T_magazine) {
+                p.depot_.push(loaded_);
+            } else if (loaded_count_) {
+                block* last = loaded_;
+                while (last->link_) {
+                    last->next_.store(last->link_, std::memory_order_relaxed);
+                    last = last->link_;
+                }
+                p.loose_.push_chain(loaded_, last);
+            }
+            // a record released later in thread exit may still reach
+            // this cache; it has to find it empty, not push the same
+            // magazines again.
+            loaded_ = spare_ = nullptr;
+            loaded_count_ = spare_count_ = 0;
+        }
+    };
+
+    static cache& local()
+    {
+        static thread_local cache c;
+        return c;
+    }
+
+    node_pool() : chunks_(0) {}
+
+    // chunk of T_magazine blocks, linked through link_.
+    block* carve()
+    {
+        char* chunk = static_cast<char*>(::operator new(block_size * T_magazine));
+        chunks_.fetch_add(1, std::memory_order_relaxed);
+        block* first = nullptr;
+        for (size_t i = T_magazine; i != 0; --i) {
+            block* b = reinterpret_cast<block*>(chunk + (i - 1) * block_size);
+            b->link_ = first;
+            first = b;
+        }
+        return first;
+    }
+
+    // sort the loose blocks into magazines: the first one is returned
+    // (with its count in `count'), further full ones go to the depot and
+    // the remainder back to loose_.
+    block* regroup(size_t& count)
+    {
+        block* n = loose_.flush();
+        if (! n) {
+            return nullptr;
+        }
+        block* result = nullptr;
+        for (;;) {
+            block* first = n;
+            size_t c = 0;
+            block* last = nullptr;
+            while (n && c != T_magazine) {
+                block* next = n->next_.load(std::memory_order_relaxed);
+                n->link_ = next;
+                last = n;
+                n = next;
+                ++c;
+            }
+            last->link_ = nullptr;
+            if (! result) {
+                result = first;
+                count = c;
+            } else if (c == T_magazine) {
+                depot_.push(first);
+            } else {
+                block* end = first;
+                while (end->link_) {
+                    end = end->link_;
+                }
+                loose_.push_chain(first, end);
+            }
+            if (! n) {
+                return result;
+            }
+        }
+    }
+
+    void refill(cache& c)
+    {
+        if (c.spare_count_) {
+            c.loaded_ = c.spare_;
+            c.loaded_count_ = c.spare_count_;
+            c.spare_ = nullptr;
+            c.spare_count_ = 0;
+        } else if (block* m = depot_.pop()) {
+            c.loaded_ = m;
+            c.loaded_count_ = T_magazine;
+        } else if (block* r = regroup(c.loaded_count_)) {
+            c.loaded_ = r;
+        } else {
+            c.loaded_ = carve();
+            c.loaded_count_ = T_magazine;
+        }
+    }
+
+    void spill(cache& c)
+    {
+        if (c.spare_count_) {
+            depot_.push(c.spare_);
+        }
+        c.spare_ = c.loaded_;
+        c.spare_count_ = c.loaded_count_;
+        c.loaded_ = nullptr;
+        c.loaded_count_ = 0;
+    }
+
+public:
+    node_pool(node_pool const&) = delete;
+    void operator = (node_pool const&) = delete;
+
+    static node_pool& get()
+    {
+        // placement, so the over-aligned depot needs no aligned new and
+        // the pool is never destroyed.
+        alignas(node_pool) static char storage[sizeof(node_pool)];
+        static node_pool* p = new (storage) node_pool;
+        return *p;
+    }
+
+    static void* allocate()
+    {
+        cache& c = local();
+        if (! c.loaded_count_) {
+            get().refill(c);
+        }
+        block* b = c.loaded_;
+        c.loaded_ = b->link_;
+        c.loaded_count_ -= 1;
+        return b;
+    }
+
+    static void deallocate(void* p)
+    {
+        cache& c = local();
+        if (c.loaded_count_ == T_magazine) {
+            get().spill(c);
+        }
+        block* b = static_cast<block*>(p);
+        b->link_ = c.loaded_;
+        c.loaded_ = b;
+        c.loaded_count_ += 1;
+    }
+
+    // carve at least `n' blocks up front and put them in the depot as full
+    // magazines. carving writes every block, so the pages are faulted in
+    // here and not on the first allocations.
+    static void reserve(size_t n)
+    {
+        node_pool& p = get();
+        for (size_t i = 0; i < n; i += T_magazine) {
+            p.depot_.push(p.carve());
+        }
+    }
+
+    // blocks taken from the system so far.
+    size_t capacity() const
+    {
+        return chunks_.load(std::memory_order_relaxed) * T_magazine;
+    }
+};
+
+
+/*
+ * std::allocator-compatible front end of node_pool: single objects come
+ * from the pool for sizeof(T), arrays from ::operator new. it is
+ * stateless, so queues can rebind it to their node type and create it
+ * wherever they need it.
+ */
+template<typename T, size_t T_magazine = 64>
+class pool_allocator
+{
+    static_assert(alignof(T) <= alignof(std::max_align_t), "over-aligned types are not pooled");
+
+public:
+    typedef T value_type;
+
+    template<typename U>
+    struct rebind
+    {
+        typedef pool_allocator<U, T_magazine> other;
+    };
+
+    typedef node_pool<sizeof(T), T_magazine> pool_type;
+
+    pool_allocator() {}
+
+    template<typename U>
+    pool_allocator(pool_allocator<U, T_magazine> const&) {}
+
+    T* allocate(size_t n)
+    {
+        if (n != 1) {
+            return static_cast<T*>(::operator new(n * sizeof(T)));
+        }
+        return static_cast<T*>(pool_type::allocate());
+    }
+
+    void deallocate(T* p, size_t n)
+    {
+        if (n != 1) {
+            ::operator delete(p);
+            return;
+        }
+        pool_type::deallocate(p);
+    }
+};
+
+template<typename T, typename U, size_t T_magazine>
+bool operator == (pool_allocator<T, T_magazine> const&, pool_allocator<U, T_magazine> const&)
+{
+    return true;
+}
+
+template<typename T, typename U, size_t T_magazine>
+bool operator != (pool_allocator<T, T_magazine> const&, pool_allocator<U, T_magazine> const&)
+{
+    return false;
+}
+
+#endif /* end of NODE_POOL_H */
@@ -0,0 +1,29 @@
+#ifndef PREFETCH_H
+#define PREFETCH_H
+
+#include <cstddef>
+
+/*
+ * software prefetch for node-based dequeue paths.
+ *
+ * a consumer walking a deep queue loads tail->next_ and then the value in
+ * that node, one dependent miss per element. the successor's address sits
+ * in the node just loaded, so a dequeue can ask for node k+1 while it
+ * returns node k, and the miss overlaps with whatever the caller does with
+ * the value. nodes larger than a line get their last line prefetched too,
+ * that is where the payload ends.
+ */
+template<typename node_t>
+inline void prefetch_node(node_t const* n)
+{
+    static size_t const line = 64;
+    if (! n) {
+        return;
+    }
+    __builtin_prefetch(n, 0, 3);
+    if (sizeof(node_t) > line) {
+        __builtin_prefetch(reinterpret_cast<char const*>(n) + sizeof(node_t) - 1, 0, 3);
+    }
+}
+
+#endif /* end of PREFETCH_H */
@@ -0,0 +1,238 @@
+#ifndef THREAD_RECORDS_H
+#define THREAD_RECORDS_H
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+/*
+ * per-thread records of a reclamation domain (hazard slots, epoch slots).
+ *
+ * records sit on a lock-free list that only ever grows; a thread takes an
+ * inactive record the first time it uses the domain and hands it back when
+ * it exits, so the list stays as long as the peak number of threads. the
+ * record is found again through a small thread_local cache keyed by domain
+ * id, no shared write is needed once a thread has its record.
+ *
+ * record_t provides `std::atomic<bool> active_', `record_t* next_' and
+ * `void release()', which clears what the thread published before the
+ * record is handed to another thread. whatever else the record owns (e.g.
+ * a retired list) comes along with it.
+ */
+class thread_record_registry
+{
+    // pins_ counts exiting threads that are releasing a record of the
+    // domain outside the mutex; remove() waits for them.
+    struct domain { uint64_t id_; unsigned pins_; };
+
+    std::mutex mutex_;
+    std::condition_variable unpinned_;
+    std::vector<domain> domains_;
+    uint64_t next_id_ = 1;
+
+    std::vector<domain>::iterator find(uint64_t id)
+    {
+        return std::find_if(domains_.begin(), domains_.end(),
+                [id](domain const& d) { return d.id_ == id; });
+    }
+
+public:
+    static thread_record_registry& get()
+    {
+        static thread_record_registry r;
+        return r;
+    }
+
+    std::mutex& mutex() { return mutex_; }
+
+    uint64_t add()
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        domains_.push_back(domain{next_id_, 0});
+        return next_id_++;
+    }
+
+    void remove(uint64_t id)
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        unpinned_.wait(lock, [&] { return find(id)->pins_ == 0; });
+        domains_.erase(find(id));
+    }
+
+    // caller holds mutex().
+    bool alive(uint64_t id)
+    {
+        return find(id) != domains_.end();
+    }
+
+    // keep domain `id' from going away until unpin(); false if it is
+    // already gone. caller holds mutex().
+    bool pin(uint64_t id)
+    {
+        std::vector<domain>::iterator d = find(id);
+        if (d == domains_.end()) {
+            return false;
+        }
+        d->pins_ += 1;
+        return true;
+    }
+
+    void unpin(uint64_t id)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (--find(id)->pins_ == 0) {
+            unpinned_.notify_all();
+        }
+    }
+};
+
+
+template<typename record_t>
+class thread_records
+{
+    // ids are never reused, so an entry of a destroyed domain can't be
+    // mistaken for a new one.
+    struct thread_cache
+    {
+        static unsigned const size = 8;
+        struct entry { uint64_t id_; record_t* rec_; } entries_[size];
+
+        thread_cache()
+        {
+            for (unsigned i = 0; i != size; ++i) {
+                entries_[i].id_ = 0;
+                entries_[i].rec_ = nullptr;
+            }
+        }
+
+        // release() may run user code (a free function, a pool push), so
+        // it runs outside the registry mutex; the pins keep the domains
+        // and their records alive meanwhile.
+        ~thread_cache()
+        {
+            thread_record_registry& registry = thread_record_registry::get();
+            entry alive[size];
+            unsigned count = 0;
+            {
+                std::lock_guard<std::mutex> lock(registry.mutex());
+                for (unsigned i = 0; i != size; ++i) {
+                    if (entries_[i].rec_ && registry.pin(entries_[i].id_)) {
+                        alive[count++] = entries_[i];
+                    }
+                    entries_[i].id_ = 0;
+                    entries_[i].rec_ = nullptr;
+                }
+            }
+            for (unsigned i = 0; i != count; ++i) {
+                release(alive[i].rec_);
+                registry.unpin(alive[i].id_);
+            }
+        }
+    };
+
+    std::atomic<record_t*> head_;
+    std::atomic<size_t> count_;
+    uint64_t const id_;
+
+    static thread_cache& cache()
+    {
+        static thread_local thread_cache c;
+        return c;
+    }
+
+    record_t* acquire()
+    {
+        for (record_t* r = head(); r; r = r->next_) {
+            bool active = false;
+            if (!r->active_.load(std::memory_order_relaxed) &&
+                    r->active_.compare_exchange_strong(active, true, std::memory_order_acq_rel)) {
+                return r;
+            }
+        }
+
+        record_t* r = new record_t;
+        r->active_.store(true, std::memory_order_relaxed);
+        record_t* head = head_.load(std::memory_order_relaxed);
+        do {
+            r->next_ = head;
+        } while (!head_.compare_exchange_weak(head, r, std::memory_order_release, std::memory_order_relaxed));
+        count_.fetch_add(1, std::memory_order_relaxed);
+        return r;
+    }
+
+public:
+    thread_records() : head_(nullptr), count_(0), id_(thread_record_registry::get().add()) {}
+
+    // the owner drains whatever the records still hold before this runs.
+    ~thread_records()
+    {
+        thread_record_registry::get().remove(id_);
+        record_t* r = head_.load(std::memory_order_relaxed);
+        while (r) {
+            record_t* next = r->next_;
+            delete r;
+            r = next;
+        }
+    }
+
+    thread_records(thread_records const&) = delete;
+    void operator = (thread_records const&) = delete;
+
+    record_t* head() const
+    {
+        return head_.load(std::memory_order_acquire);
+    }
+
+    size_t size() const
+    {
+        return count_.load(std::memory_order_relaxed);
+    }
+
+    // the calling thread's record. `owned' is set when the thread cache is
+    // full, the caller then hands the record back with release().
+    record_t* local(bool& owned)
+    {
+        thread_cache& c = cache();
+        owned = false;
+        for (unsigned i = 0; i != thread_cache::size; ++i) {
+            if (c.entries_[i].id_ == id_) {
+                return c.entries_[i].rec_;
+            }
+        }
+
+        record_t* r = acquire();
+        for (int pass = 0; pass != 2; ++pass) {
+            for (unsigned i = 0; i != thread_cache::size; ++i) {
+                if (!c.entries_[i].rec_) {
+                    c.entries_[i].id_ = id_;
+                    c.entries_[i].rec_ = r;
+                    return r;
+                }
+            }
+            // full, drop entries of domains that are gone and retry.
+            thread_record_registry& registry = thread_record_registry::get();
+            std::lock_guard<std::mutex> lock(registry.mutex());
+            for (unsigned i = 0; i != thread_cache::size; ++i) {
+                if (!registry.alive(c.entries_[i].id_)) {
+                    c.entries_[i].id_ = 0;
+                    c.entries_[i].rec_ = nullptr;
+                }
+            }
+        }
+
+        owned = true;
+        return r;
+    }
+
+    static void release(record_t* r)
+    {
+        r->release();
+        r->active_.store(false, std::memory_order_release);
+    }
+};
+
+#endif /* end of THREAD_RECORDS_H */
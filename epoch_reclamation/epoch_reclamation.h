@@ -0,0 +1,228 @@
+#ifndef EPOCH_RECLAMATION_H
+#define EPOCH_RECLAMATION_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+#include "../common/defer_node.h"
+#include "../common/thread_records.h"
+
+/*
+ * epoch based reclamation domain.
+ *
+ * every thread owns a cache-line sized record with an epoch slot. entering
+ * a critical section copies the global epoch into the slot, leaving it
+ * stores 0 (quiescent); neither writes anything another thread writes, so
+ * readers scale with their count instead of bouncing one shared counter.
+ * nested guards on the same thread only bump a plain nesting count.
+ *
+ * a retired object goes into one of three per-thread limbo lists, picked by
+ * the global epoch at retire time. it is freed once the global epoch has
+ * moved two steps past that, by which time every thread that was inside a
+ * critical section when it was retired has left it. retirers advance the
+ * global epoch every `advance_every' retires, which only succeeds when
+ * every active slot has caught up with it; a reader stalled inside a
+ * critical section therefore holds back all reclamation.
+ */
+class epoch_domain
+{
+public:
+    class guard;
+
+private:
+    static unsigned const limbo_count = 3;
+
+    // padded on both sides, heap records aren't aligned to a cache line in
+    // c++11 and the epoch slot must not share one with anyone else's data.
+    struct record
+    {
+        char pad0_[64];
+        std::atomic<uint64_t> epoch_; // 0 when outside a critical section
+        std::atomic<bool> active_;
+        record* next_;
+        unsigned nesting_;
+        unsigned retires_; // since the last advance attempt
+        defer_node* limbo_[limbo_count];
+        uint64_t limbo_epoch_[limbo_count];
+        char pad1_[64];
+
+        record() : next_(nullptr), nesting_(0), retires_(0)
+        {
+            epoch_.store(0, std::memory_order_relaxed);
+            for (unsigned i = 0; i != limbo_count; ++i) {
+                limbo_[i] = nullptr;
+                limbo_epoch_[i] = 0;
+            }
+        }
+
+        void release()
+        {
+            epoch_.store(0, std::memory_order_relaxed);
+            nesting_ = 0;
+        }
+    };
+
+    alignas(64) std::atomic<uint64_t> epoch_;
+    char pad_[64 - sizeof(std::atomic<uint64_t>)];
+    thread_records<record> records_;
+    unsigned const advance_every_;
+
+    void enter(record* r)
+    {
+        if (r->nesting_++ == 0) {
+            // the fence orders the announcement before the re-read and any
+            // load of the structure and pairs with the one in try_advance();
+            // a seq_cst store alone would let later acquire loads pass it.
+            // the epoch is re-read because it may have moved on while we
+            // were publishing a stale one that an advancer didn't see.
+            uint64_t e = epoch_.load(std::memory_order_relaxed);
+            for (;;) {
+                r->epoch_.store(e, std::memory_order_relaxed);
+                std::atomic_thread_fence(std::memory_order_seq_cst);
+                uint64_t now = epoch_.load(std::memory_order_relaxed);
+                if (now == e) {
+                    break;
+                }
+                e = now;
+            }
+        }
+    }
+
+    void leave(record* r)
+    {
+        if (--r->nesting_ == 0) {
+            r->epoch_.store(0, std::memory_order_release);
+        }
+    }
+
+    // move the global epoch on if every thread inside a critical section
+    // has seen the current one.
+    uint64_t try_advance()
+    {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        uint64_t e = epoch_.load(std::memory_order_relaxed);
+        for (record* q = records_.head(); q; q = q->next_) {
+            uint64_t seen = q->epoch_.load(std::memory_order_acquire);
+            if (seen && seen != e) {
+                return e;
+            }
+        }
+        if (epoch_.compare_exchange_strong(e, e + 1, std::memory_order_acq_rel)) {
+            return e + 1;
+        }
+        return e;
+    }
+
+    // free the limbo lists that are two epochs behind `e'.
+    static void reclaim(record* r, uint64_t e)
+    {
+        for (unsigned i = 0; i != limbo_count; ++i) {
+            if (r->limbo_[i] && r->limbo_epoch_[i] + 2 <= e) {
+                defer_node* n = r->limbo_[i];
+                r->limbo_[i] = nullptr;
+                destroy(n);
+            }
+        }
+    }
+
+    void retire(record* r, defer_node* n, void (*free_fn)(defer_node*))
+    {
+        n->defer_free_ = free_fn;
+        uint64_t e = epoch_.load(std::memory_order_acquire);
+        if (++r->retires_ >= advance_every_) {
+            r->retires_ = 0;
+            e = try_advance();
+        }
+        reclaim(r, e);
+
+        unsigned i = e % limbo_count;
+        n->defer_next_ = r->limbo_[i];
+        r->limbo_[i] = n;
+        r->limbo_epoch_[i] = e;
+    }
+
+    static void destroy(defer_node* n)
+    {
+        while (n) {
+            defer_node* next = n->defer_next_;
+            n->defer_free_(n);
+            n = next;
+        }
+    }
+
+public:
+    explicit epoch_domain(unsigned advance_every = 64)
+        : epoch_(1), advance_every_(advance_every ? advance_every : 1) {}
+
+    ~epoch_domain()
+    {
+        for (record* r = records_.head(); r; r = r->next_) {
+            for (unsigned i = 0; i != limbo_count; ++i) {
+                destroy(r->limbo_[i]);
+            }
+        }
+    }
+
+    epoch_domain(epoch_domain const&) = delete;
+    void operator = (epoch_domain const&) = delete;
+
+    uint64_t epoch() const
+    {
+        return epoch_.load(std::memory_order_relaxed);
+    }
+
+    // try to advance and free what the calling thread can, e.g. before it
+    // goes idle.
+    void collect()
+    {
+        bool owned;
+        record* r = records_.local(owned);
+        reclaim(r, try_advance());
+        if (owned) {
+            records_.release(r);
+        }
+    }
+};
+
+
+// scoped critical section, may be nested on a thread.
+class epoch_domain::guard
+{
+    epoch_domain& domain_;
+    record* rec_;
+    bool owned_;
+
+public:
+    explicit guard(epoch_domain& d) : domain_(d), rec_(d.records_.local(owned_))
+    {
+        domain_.enter(rec_);
+    }
+
+    ~guard()
+    {
+        domain_.leave(rec_);
+        if (owned_) {
+            domain_.records_.release(rec_);
+        }
+    }
+
+    guard(guard const&) = delete;
+    void operator = (guard const&) = delete;
+
+    template<typename N>
+    N* protect(unsigned, std::atomic<N*> const& src)
+    {
+        return src.load(std::memory_order_acquire);
+    }
+
+    template<typename N>
+    void publish(unsigned, N*) {}
+
+    void retire(defer_node* n, void (*free_fn)(defer_node*))
+    {
+        domain_.retire(rec_, n, free_fn);
+    }
+};
+
+#endif /* end of EPOCH_RECLAMATION_H */
@@ -0,0 +1,206 @@
+#ifndef HAZARD_POINTER_H
+#define HAZARD_POINTER_H
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <vector>
+
+#include "../common/defer_node.h"
+#include "../common/thread_records.h"
+
+/*
+ * hazard pointer reclamation domain.
+ *
+ * every thread owns a record with `max_slots' hazard slots and a private
+ * list of retired objects. a reader publishes the pointer it is about to
+ * dereference in a slot and re-validates it; a retired object is freed by
+ * a scan once no slot of any record holds it. scans run when a thread has
+ * retired about twice as many objects as there are slots in the domain,
+ * so their cost is amortised to O(1) per retired object, and a stalled
+ * reader can pin at most `max_slots' objects.
+ *
+ * the hazard is compared with the address of the defer_node hook, so the
+ * hook has to be the first base of the node type (no vtable in front).
+ *
+ * a thread keeps its record (see common/thread_records.h) for the lifetime
+ * of the thread; the domain must not be used by a thread after the domain
+ * is destroyed.
+ */
+class hazard_domain
+{
+public:
+    static unsigned const max_slots = 4;
+    class guard;
+
+private:
+    struct record
+    {
+        std::atomic<void const*> hazards_[max_slots];
+        std::atomic<bool> active_;
+        record* next_; // registry link, records are never unlinked
+        defer_node* retired_; // owned by the thread holding the record
+        size_t retired_count_;
+        std::vector<void const*> scratch_; // hazard snapshot for scans
+        char pad_[64];
+
+        record() : next_(nullptr), retired_(nullptr), retired_count_(0)
+        {
+            for (unsigned i = 0; i != max_slots; ++i) {
+                hazards_[i].store(nullptr, std::memory_order_relaxed);
+            }
+        }
+
+        void release()
+        {
+            for (unsigned i = 0; i != max_slots; ++i) {
+                hazards_[i].store(nullptr, std::memory_order_relaxed);
+            }
+        }
+    };
+
+    thread_records<record> records_;
+    size_t const scan_min_;
+
+    void retire(record* r, defer_node* n, void (*free_fn)(defer_node*))
+    {
+        n->defer_free_ = free_fn;
+        n->defer_next_ = r->retired_;
+        r->retired_ = n;
+        if (++r->retired_count_ >= scan_threshold()) {
+            scan(r);
+        }
+    }
+
+    size_t scan_threshold() const
+    {
+        size_t hazards = 2 * max_slots * records_.size();
+        return hazards > scan_min_ ? hazards : scan_min_;
+    }
+
+    void scan(record* r)
+    {
+        // pairs with the fence in guard::publish: a reader either sees the
+        // object unlinked when it validates, or we see its hazard here.
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+
+        std::vector<void const*>& hazards = r->scratch_;
+        hazards.clear();
+        for (record* q = records_.head(); q; q = q->next_) {
+            for (unsigned i = 0; i != max_slots; ++i) {
+                void const* p = q->hazards_[i].load(std::memory_order_acquire);
+                if (p) {
+                    hazards.push_back(p);
+                }
+            }
+        }
+        std::sort(hazards.begin(), hazards.end());
+
+        defer_node* n = r->retired_;
+        defer_node* keep = nullptr;
+        size_t kept = 0;
+        while (n) {
+            defer_node* next = n->defer_next_;
+            if (std::binary_search(hazards.begin(), hazards.end(), static_cast<void const*>(n))) {
+                n->defer_next_ = keep;
+                keep = n;
+                kept += 1;
+            } else {
+                n->defer_free_(n);
+            }
+            n = next;
+        }
+        r->retired_ = keep;
+        r->retired_count_ = kept;
+    }
+
+    static void destroy(defer_node* n)
+    {
+        while (n) {
+            defer_node* next = n->defer_next_;
+            n->defer_free_(n);
+            n = next;
+        }
+    }
+
+public:
+    explicit hazard_domain(size_t scan_min = 64) : scan_min_(scan_min) {}
+
+    ~hazard_domain()
+    {
+        for (record* r = records_.head(); r; r = r->next_) {
+            destroy(r->retired_);
+        }
+    }
+
+    hazard_domain(hazard_domain const&) = delete;
+    void operator = (hazard_domain const&) = delete;
+
+    // scan the calling thread's retired list now, e.g. before going idle.
+    void collect()
+    {
+        bool owned;
+        record* r = records_.local(owned);
+        scan(r);
+        if (owned) {
+            records_.release(r);
+        }
+    }
+};
+
+
+// one guard per thread and domain at a time, the slots are per thread.
+class hazard_domain::guard
+{
+    hazard_domain& domain_;
+    record* rec_;
+    bool owned_;
+
+public:
+    explicit guard(hazard_domain& d) : domain_(d), rec_(d.records_.local(owned_)) {}
+
+    ~guard()
+    {
+        if (owned_) {
+            domain_.records_.release(rec_);
+        } else {
+            for (unsigned i = 0; i != max_slots; ++i) {
+                rec_->hazards_[i].store(nullptr, std::memory_order_release);
+            }
+        }
+    }
+
+    guard(guard const&) = delete;
+    void operator = (guard const&) = delete;
+
+    // load `src' into `slot' and keep it there until it is stable.
+    template<typename N>
+    N* protect(unsigned slot, std::atomic<N*> const& src)
+    {
+        N* p = src.load(std::memory_order_relaxed);
+        for (;;) {
+            publish(slot, p);
+            N* q = src.load(std::memory_order_acquire);
+            if (q == p) {
+                return p;
+            }
+            p = q;
+        }
+    }
+
+    // publish `p' in `slot'; the caller re-validates that `p' is still
+    // reachable before using it.
+    template<typename N>
+    void publish(unsigned slot, N* p)
+    {
+        rec_->hazards_[slot].store(static_cast<void const*>(p), std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+    }
+
+    void retire(defer_node* n, void (*free_fn)(defer_node*))
+    {
+        domain_.retire(rec_, n, free_fn);
+    }
+};
+
+#endif /* end of HAZARD_POINTER_H */
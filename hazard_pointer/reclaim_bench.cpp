@@ -0,0 +1,166 @@
+/*
+ * reclamation schemes under a stalled reader.
+ *
+ * writers push and pop nodes on the lock-free stack and retire what they
+ * pop, readers peek at the head in short critical sections. one more
+ * reader enters a critical section, protects the head and then sleeps for
+ * the whole run. the scheme is picked at compile time:
+ *
+ *     -DRECLAIM_HAZARD            hazard_pointer.h
+ *     -DRECLAIM_EPOCH             epoch_reclamation/epoch_reclamation.h
+ *     -DRECLAIM_PROXY_COLLECTOR   mpmc_unbounded_queue/proxy_collector.h
+ *     (default)                   proxy_collector/proxy.h, proxy<>
+ *
+ * every run reports writer cycles/op and the peak number of retired but
+ * not yet freed nodes, once without and once with the stalled reader.
+ */
+
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+#if defined(RECLAIM_HAZARD)
+#include "hazard_pointer.h"
+#include "../proxy_collector/stack.h"
+typedef hazard_domain domain_t;
+static char const* const scheme = "hazard_pointer";
+#elif defined(RECLAIM_EPOCH)
+#include "../epoch_reclamation/epoch_reclamation.h"
+#include "../proxy_collector/stack.h"
+typedef epoch_domain domain_t;
+static char const* const scheme = "epoch";
+#elif defined(RECLAIM_PROXY_COLLECTOR)
+#include "../mpmc_unbounded_queue/proxy_collector.h"
+#include "../proxy_collector/stack.h"
+typedef proxy domain_t;
+static char const* const scheme = "proxy_collector.h";
+#else
+#include "../proxy_collector/proxy.h"
+#include "../proxy_collector/stack.h"
+typedef proxy<256, 4, node> domain_t;
+static char const* const scheme = "proxy<>";
+#endif
+
+#define WRITERS 2
+#define READERS 2
+#define ITERS 1000000
+
+static std::atomic<long> g_retired{0};
+static std::atomic<long> g_freed{0};
+static std::atomic<bool> g_done{false};
+
+static void free_node(defer_node* n) {
+    g_freed.fetch_add(1, std::memory_order_relaxed);
+    delete static_cast<node*>(n);
+}
+
+static inline uint64_t rdtsc() {
+    uint64_t lo, hi;
+    __asm__ volatile ("rdtsc"
+            : "=a" (lo), "=d"(hi) /*outputs */
+            : /* no input parameters */
+            : "%ebx", "%ecx", "memory"); /* clobbers */
+    return lo | (hi << 32);
+}
+
+static void writer(domain_t& domain, stack& s) {
+    for (long i = 0; i != ITERS; ++i) {
+        s.push(new node);
+        domain_t::guard g(domain);
+        node* n = s.pop(g);
+        if (n) {
+            g_retired.fetch_add(1, std::memory_order_relaxed);
+            g.retire(n, &free_node);
+        }
+    }
+}
+
+static void reader(domain_t& domain, stack& s) {
+    while (!g_done.load(std::memory_order_relaxed)) {
+        domain_t::guard g(domain);
+        node* n = s.peek(g);
+        if (n) {
+            n->next_.load(std::memory_order_relaxed);
+        }
+    }
+}
+
+static void stalled_reader(domain_t& domain, stack& s, std::atomic<bool>& entered) {
+    domain_t::guard g(domain);
+    s.peek(g);
+    entered = true;
+    while (!g_done.load(std::memory_order_relaxed)) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+}
+
+static void run(bool stall) {
+    domain_t domain;
+    stack s;
+    s.push(new node); // something for the stalled reader to hold on to
+
+    g_retired = 0;
+    g_freed = 0;
+    g_done = false;
+
+    std::vector<std::thread> readers;
+    std::atomic<bool> entered{!stall};
+    if (stall) {
+        readers.push_back(std::thread(stalled_reader, std::ref(domain), std::ref(s), std::ref(entered)));
+    }
+    while (!entered) {
+        std::this_thread::yield();
+    }
+    for (int i = 0; i != READERS; ++i) {
+        readers.push_back(std::thread(reader, std::ref(domain), std::ref(s)));
+    }
+
+    uint64_t start = rdtsc();
+    std::vector<std::thread> writers;
+    for (int i = 0; i != WRITERS; ++i) {
+        writers.push_back(std::thread(writer, std::ref(domain), std::ref(s)));
+    }
+
+    // freed is read first, so the difference never undercounts.
+    long peak = 0;
+    std::atomic<int> running{WRITERS};
+    std::thread monitor([&] {
+        while (running.load(std::memory_order_relaxed)) {
+            long freed = g_freed.load(std::memory_order_relaxed);
+            long pending = g_retired.load(std::memory_order_relaxed) - freed;
+            if (pending > peak) {
+                peak = pending;
+            }
+            std::this_thread::sleep_for(std::chrono::microseconds(100));
+        }
+    });
+
+    for (int i = 0; i != WRITERS; ++i) {
+        writers[i].join();
+        running.fetch_sub(1);
+    }
+    uint64_t end = rdtsc();
+    monitor.join();
+
+    g_done = true;
+    for (size_t i = 0; i != readers.size(); ++i) {
+        readers[i].join();
+    }
+
+    std::cout << scheme << (stall ? " stalled reader" : " no stall      ")
+        << " cycles/op=" << (end - start) / (ITERS * WRITERS)
+        << " peak unreclaimed=" << peak
+        << " (" << peak * (long)sizeof(node) / 1024 << "KiB)" << std::endl;
+
+    while (node* n = s.pop()) {
+        delete n;
+    }
+}
+
+int main() {
+    run(false);
+    run(true);
+    return 0;
+}
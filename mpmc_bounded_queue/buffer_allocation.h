@@ -0,0 +1,155 @@
+#ifndef BUFFER_ALLOCATION_H
+#define BUFFER_ALLOCATION_H
+
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <sys/mman.h>
+
+#ifdef __linux__
+#include <unistd.h>
+#include <sys/syscall.h>
+#endif
+
+/*
+ * allocation policies for the ring buffer of mpmc_bounded_queue.
+ *
+ * a policy is a copyable object with
+ *     void* allocate(size_t bytes);
+ *     void  deallocate(void* p, size_t bytes);
+ * the queue constructs the cells in place, so the policy only deals
+ * with raw memory.
+ */
+
+// plain ::operator new, same as the original `new cell_t[]`
+struct heap_allocation
+{
+    void* allocate(size_t bytes)
+    {
+        return ::operator new(bytes);
+    }
+
+    void deallocate(void* p, size_t)
+    {
+        ::operator delete(p);
+    }
+};
+
+
+// anonymous mmap with optional huge pages, numa binding and prefaulting.
+// every feature degrades silently when the platform refuses it, so the
+// same binary runs on a single-node box without reserved huge pages.
+class mmap_allocation
+{
+public:
+    enum {
+        huge_tlb         = 1 << 0, // MAP_HUGETLB, needs reserved pages
+        transparent_huge = 1 << 1, // MADV_HUGEPAGE, fallback for huge_tlb
+        prefault         = 1 << 2, // touch every page at construction
+        lock             = 1 << 3, // mlock, implies prefault
+    };
+
+    static size_t const huge_page_size = 2 * 1024 * 1024;
+    static size_t const page_size = 4096;
+
+    explicit mmap_allocation(unsigned flags = transparent_huge | prefault,
+                             int numa_node = -1)
+        : flags_(flags), numa_node_(numa_node), used_flags_(0), bound_(false) {}
+
+    void* allocate(size_t bytes)
+    {
+        size_t len = map_length(bytes);
+        void* p = MAP_FAILED;
+        used_flags_ = 0;
+
+#if defined(__linux__) && defined(MAP_HUGETLB)
+        if (flags_ & huge_tlb) {
+            p = mmap(nullptr, len, PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+            if (p != MAP_FAILED) {
+                used_flags_ |= huge_tlb;
+            }
+        }
+#endif
+        if (p == MAP_FAILED) {
+            p = mmap(nullptr, len, PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if (p == MAP_FAILED) {
+                throw std::bad_alloc();
+            }
+#if defined(__linux__) && defined(MADV_HUGEPAGE)
+            if ((flags_ & (huge_tlb | transparent_huge)) &&
+                    madvise(p, len, MADV_HUGEPAGE) == 0) {
+                used_flags_ |= transparent_huge;
+            }
+#endif
+        }
+
+        // bind before the first touch, otherwise the pages already live
+        // on the node of the constructing thread.
+        bound_ = bind(p, len);
+
+        if (flags_ & lock) {
+            if (mlock(p, len) == 0) {
+                used_flags_ |= lock;
+            }
+        }
+        if ((flags_ & (prefault | lock)) && !(used_flags_ & lock)) {
+            char volatile* c = static_cast<char*>(p);
+            for (size_t i = 0; i < len; i += page_size) {
+                c[i] = 0;
+            }
+            used_flags_ |= prefault;
+        }
+
+        return p;
+    }
+
+    void deallocate(void* p, size_t bytes)
+    {
+        size_t len = map_length(bytes);
+        if (used_flags_ & lock) {
+            munlock(p, len);
+        }
+        munmap(p, len);
+    }
+
+    // what the last allocate() actually got, for reporting.
+    unsigned used_flags() const { return used_flags_; }
+    bool numa_bound() const { return bound_; }
+
+private:
+    unsigned flags_;
+    int numa_node_;
+    unsigned used_flags_;
+    bool bound_;
+
+    size_t map_length(size_t bytes) const
+    {
+        size_t align = (flags_ & (huge_tlb | transparent_huge)) ? huge_page_size : page_size;
+        return (bytes + align - 1) & ~(align - 1);
+    }
+
+    bool bind(void* p, size_t len) const
+    {
+#if defined(__linux__) && defined(SYS_mbind)
+        // raw syscall, so we don't need libnuma just for this.
+        static int const mpol_bind = 2;
+        static size_t const max_node = 1024;
+        if (numa_node_ < 0 || (size_t)numa_node_ >= max_node) {
+            return false;
+        }
+        unsigned long mask[max_node / (8 * sizeof(unsigned long))] = {};
+        size_t bits = 8 * sizeof(unsigned long);
+        mask[numa_node_ / bits] = 1UL << (numa_node_ % bits);
+        // fails with EINVAL on a node that doesn't exist and with ENOSYS
+        // on kernels without numa, both just mean "leave it where it is".
+        return syscall(SYS_mbind, p, len, mpol_bind, mask, max_node + 1, 0) == 0;
+#else
+        (void)p; (void)len;
+        return false;
+#endif
+    }
+};
+
+#endif /* end of BUFFER_ALLOCATION_H */
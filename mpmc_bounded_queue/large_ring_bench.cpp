@@ -0,0 +1,119 @@
+/*
+ * mpmc_bounded_queue on a 1M-cell ring with the different buffer
+ * allocation policies. each thread pushes a batch large enough that the
+ * threads together sweep the whole ring, so every pass walks all of its
+ * pages and the TLB reach of the buffer shows up in cycles/op.
+ */
+
+#include <iostream>
+#include <functional>
+#include <thread>
+#include <atomic>
+#include <array>
+#include <chrono>
+#include <xmmintrin.h> // for _mm_pause
+
+#include "mpmc_bounded_queue.h"
+
+static size_t const thread_count = 4;
+static size_t const ring_size = 1 << 20;
+static size_t const batch_size = ring_size / thread_count;
+static size_t const iter_count = 8;
+
+static std::atomic<bool> volatile g_start{0};
+
+static inline uint64_t rdtsc() {
+    uint64_t lo, hi;
+    __asm__ volatile ("rdtsc"
+            : "=a" (lo), "=d"(hi) /*outputs */
+            : /* no input parameters */
+            : "%ebx", "%ecx", "memory"); /* clobbers */
+    return lo | (hi << 32);
+}
+
+template<typename queue_t>
+static void thread_func(queue_t &queue) {
+    int data;
+
+    while (g_start == 0) {
+        std::this_thread::yield();
+    }
+
+    for (size_t iter = 0; iter != iter_count; ++iter) {
+        for (size_t i = 0; i != batch_size; i += 1) {
+            while (!queue.enqueue(i)) {
+                std::this_thread::yield();
+            }
+        }
+        for (size_t i = 0; i != batch_size; i += 1) {
+            while (!queue.dequeue(data)) {
+                std::this_thread::yield();
+            }
+        }
+    }
+}
+
+template<typename allocation_t>
+static void run(char const* name, allocation_t const& allocation) {
+    typedef mpmc_bounded_queue<int, ring_size, allocation_t> queue_t;
+
+    g_start = 0;
+
+    auto build_start = std::chrono::steady_clock::now();
+    queue_t* queue = new queue_t(allocation);
+    auto build_end = std::chrono::steady_clock::now();
+
+    std::array<std::thread, thread_count> threads;
+    for (size_t i = 0; i != thread_count; ++i) {
+        threads[i] = std::thread(thread_func<queue_t>, std::ref(*queue));
+    }
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+    uint64_t start = rdtsc();
+    g_start = 1;
+
+    for (size_t i = 0; i != thread_count; ++i) {
+        threads[i].join();
+    }
+
+    uint64_t end = rdtsc();
+    uint64_t time = end - start;
+    std::cout << name
+        << " construct_us="
+        << std::chrono::duration_cast<std::chrono::microseconds>(build_end - build_start).count()
+        << " cycles/op="
+        << time / (batch_size * iter_count * 2 * thread_count);
+
+    delete queue;
+    std::cout << std::endl;
+}
+
+static void run_mmap(char const* name, unsigned flags, int numa_node) {
+    mmap_allocation allocation(flags, numa_node);
+    typedef mpmc_bounded_queue<int, ring_size, mmap_allocation> queue_t;
+
+    // report what the platform actually granted before timing.
+    {
+        queue_t probe(allocation);
+        unsigned used = probe.allocation().used_flags();
+        std::cout << name << " got:"
+            << ((used & mmap_allocation::huge_tlb) ? " hugetlb" : "")
+            << ((used & mmap_allocation::transparent_huge) ? " thp" : "")
+            << ((used & mmap_allocation::prefault) ? " prefault" : "")
+            << ((used & mmap_allocation::lock) ? " mlock" : "")
+            << (probe.allocation().numa_bound() ? " numa-bound" : "")
+            << std::endl;
+    }
+
+    run(name, allocation);
+}
+
+int main() {
+    run("heap         ", heap_allocation());
+    run_mmap("mmap 4k      ", mmap_allocation::prefault, -1);
+    run_mmap("mmap thp     ", mmap_allocation::transparent_huge | mmap_allocation::prefault, -1);
+    run_mmap("mmap hugetlb ", mmap_allocation::huge_tlb | mmap_allocation::prefault, -1);
+    run_mmap("thp node0    ", mmap_allocation::transparent_huge | mmap_allocation::prefault, 0);
+    run_mmap("thp node0 mlk", mmap_allocation::transparent_huge | mmap_allocation::lock, 0);
+}
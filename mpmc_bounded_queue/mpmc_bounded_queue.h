@@ -0,0 +1,187 @@
+/* Multi-producer/multi-consumer bounded queue
+ * Copyright (c) 2010-2011 Dmitry Vyukov. All rights reserved.
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ *    1. Redistributions of source code must retain the above copyright notice,
+ *       this list of conditions and the following disclaimer.
+ * 
+ *    2. Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY DMITRY VYUKOV "AS IS" AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT
+ * SHALL DMITRY VYUKOV OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+ * OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * The views and conclusions contained in the software and documentation are
+ * those of the authors and should not be interpreted as representing official
+ * policies, either expressed or implied, of Dmitry Vyukov.
+ */
+
+#ifndef MPMC_BOUNDED_QUEUE_H
+#define MPMC_BOUNDED_QUEUE_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <new>
+
+#include "buffer_allocation.h"
+
+template<typename T, size_t buffer_size, typename allocation_t = heap_allocation>
+class mpmc_bounded_queue
+{
+private:
+    struct cell_t {
+        std::atomic<size_t> sequence_;
+        T                   data_;
+    };
+
+    static size_t const     cacheline_size = 64;
+    typedef char            cacheline_pad_t [cacheline_size];
+
+    cacheline_pad_t         pad0_;
+    allocation_t            allocation_;
+    cell_t *const           buffer_;
+    size_t const            buffer_mask_ = buffer_size-1;
+    cacheline_pad_t         pad1_;
+    std::atomic<size_t>     enqueue_pos_;
+    cacheline_pad_t         pad2_;
+    std::atomic<size_t>     dequeue_pos_;
+    cacheline_pad_t         pad3_;
+
+    // set in enqueue_pos_ by close(), makes every later enqueue CAS fail.
+    static size_t const     closed_bit_ = ~(~(size_t)0 >> 1);
+
+public:
+    static_assert(
+            (buffer_size >= 2) && ((buffer_size & (buffer_size - 1)) == 0),
+            "bad buffer size, no room for mask");
+    mpmc_bounded_queue(mpmc_bounded_queue const&) = delete;
+    void operator = (mpmc_bounded_queue const&) = delete;
+
+public:
+    explicit mpmc_bounded_queue(allocation_t const& allocation = allocation_t())
+        : allocation_(allocation)
+        , buffer_(static_cast<cell_t*>(allocation_.allocate(sizeof(cell_t) * buffer_size)))
+    {
+        for (size_t i = 0; i != buffer_size; i += 1) {
+            new (&buffer_[i]) cell_t;
+            buffer_[i].sequence_.store(i, std::memory_order_relaxed);
+        }
+        enqueue_pos_.store(0, std::memory_order_relaxed);
+        dequeue_pos_.store(0, std::memory_order_relaxed);
+    }
+
+    ~mpmc_bounded_queue() {
+        for (size_t i = 0; i != buffer_size; i += 1) {
+            buffer_[i].~cell_t();
+        }
+        allocation_.deallocate(buffer_, sizeof(cell_t) * buffer_size);
+    }
+
+    allocation_t const& allocation() const { return allocation_; }
+
+    bool enqueue(T const& data) {
+        cell_t* cell;
+        size_t pos = enqueue_pos_.load(std::memory_order_relaxed);
+        for (;;) {
+            if (pos & closed_bit_) {
+                return false;
+            }
+            cell = &buffer_[pos & buffer_mask_];
+            size_t seq = cell->sequence_.load(std::memory_order_acquire);
+            intptr_t dif = (intptr_t)seq - (intptr_t)pos;
+            if (dif == 0) {
+                if (enqueue_pos_.compare_exchange_weak(
+                            pos, pos + 1, std::memory_order_relaxed)) {
+                    break;
+                }
+            } else if (dif < 0) {
+                return false;
+            } else {
+                pos = enqueue_pos_.load(std::memory_order_relaxed);
+            }
+        }
+
+        cell->data_ = data;
+        cell->sequence_.store(pos + 1, std::memory_order_release);
+
+        return true;
+    }
+
+    bool dequeue(T& data) {
+        cell_t* cell;
+        size_t pos = dequeue_pos_.load(std::memory_order_relaxed);
+        for (;;) {
+            cell = &buffer_[pos & buffer_mask_];
+            size_t seq = cell->sequence_.load(std::memory_order_acquire);
+            intptr_t dif = (intptr_t)seq - (intptr_t)(pos + 1);
+            if (dif == 0) {
+                if (dequeue_pos_.compare_exchange_weak(
+                            pos, pos + 1, std::memory_order_relaxed)) {
+                    break;
+                }
+            } else if (dif < 0) {
+                return false;
+            } else {
+                pos = dequeue_pos_.load(std::memory_order_relaxed);
+            }
+        }
+
+        data = cell->data_;
+        cell->sequence_.store(pos + buffer_mask_ + 1, std::memory_order_release);
+
+        return true;
+    }
+
+    // wait-free snapshot of the depth, only meaningful as a hint while
+    // other threads are running.
+    size_t size_approx() const {
+        size_t deq = dequeue_pos_.load(std::memory_order_relaxed);
+        size_t enq = enqueue_pos_.load(std::memory_order_relaxed) & ~closed_bit_;
+        intptr_t dif = (intptr_t)enq - (intptr_t)deq;
+        if (dif < 0) {
+            return 0;
+        }
+        return (size_t)dif > buffer_size ? buffer_size : (size_t)dif;
+    }
+
+    bool empty() const {
+        return size_approx() == 0;
+    }
+
+    size_t capacity() const {
+        return buffer_size;
+    }
+
+    // O(1) shutdown: enqueues fail from now on, dequeues keep draining
+    // what was enqueued before.
+    void close() {
+        enqueue_pos_.fetch_or(closed_bit_, std::memory_order_acq_rel);
+    }
+
+    bool is_closed() const {
+        return (enqueue_pos_.load(std::memory_order_acquire) & closed_bit_) != 0;
+    }
+
+    // true once the queue is closed and everything enqueued before the
+    // close has been dequeued. it stays true, so a consumer whose dequeue
+    // failed can stop when it sees this.
+    bool closed() const {
+        size_t enq = enqueue_pos_.load(std::memory_order_acquire);
+        if (!(enq & closed_bit_)) {
+            return false;
+        }
+        return dequeue_pos_.load(std::memory_order_acquire) == (enq & ~closed_bit_);
+    }
+};
+
+#endif /* end of MPMC_BOUNDED_QUEUE_H */
@@ -0,0 +1,376 @@
+#ifndef MPMC_WAIT_FREE_QUEUE_H
+#define MPMC_WAIT_FREE_QUEUE_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <stdexcept>
+
+#include "buffer_allocation.h"
+#include "../common/thread_records.h"
+
+/*
+ * wait-free bounded multi-producer/multi-consumer queue, with the ring and
+ * the interface of mpmc_bounded_queue.
+ *
+ * mpmc_bounded_queue claims a cell with a CAS on enqueue_pos_ or
+ * dequeue_pos_, and a thread can lose that CAS any number of times. here an
+ * operation runs the same loop for at most max_fast_tries rounds (fast
+ * path), then announces its request in the thread's record and is finished
+ * by whoever looks at that record (slow path, the fast-path/slow-path
+ * scheme of Kogan and Petrank).
+ *
+ * a helper that finds the next cell free for an announced request does not
+ * move the position word to pos + 1 but stores a reservation in it: the
+ * record's index and request seq next to pos. anybody who meets a
+ * reservation resolves it before going on. if that request is still pending
+ * it is granted pos (a CAS on the record's state) and the position word
+ * moves on, otherwise the reservation is dropped and pos is free again. a
+ * request also remembers the position at the time it was announced and
+ * never takes one below it, so a stale reservation can't hand out a
+ * position twice. the owner of a granted request writes or reads the cell
+ * itself, exactly like a fast-path winner.
+ *
+ * every help_delay operations a thread looks at one other record, round
+ * robin, and helps a pending request there to completion. once a request
+ * is announced, every thread works on it after a bounded number of its own
+ * operations, which bounds every enqueue and dequeue.
+ *
+ * limits: at most max_records threads use a queue at the same time (records
+ * go back when their thread exits), positions are compared modulo 2^40 and
+ * request seqs modulo 2^16.
+ */
+template<typename T, size_t buffer_size, typename allocation_t = heap_allocation>
+class mpmc_wait_free_queue
+{
+public:
+    static size_t const     max_records = 127;
+    static unsigned const   max_fast_tries = 8;
+    static unsigned const   help_delay = 32;
+
+private:
+    struct cell_t {
+        std::atomic<uint64_t> sequence_;
+        T                     data_;
+    };
+
+    enum side_t { enq = 0, deq = 1 };
+
+    // position words: closed bit (enqueue side), reserving record index + 1,
+    // its request seq, position.
+    static unsigned const   pos_bits = 40;
+    static uint64_t const   pos_mask = ((uint64_t)1 << pos_bits) - 1;
+    static unsigned const   seq_shift = pos_bits;
+    static uint64_t const   seq_mask = 0xffff;
+    static unsigned const   owner_shift = 56;
+    static uint64_t const   owner_mask = 0x7f;
+    static uint64_t const   closed_bit_ = (uint64_t)1 << 63;
+
+    // request states: kind, request seq, position (granted, or the one at
+    // announcement while pending).
+    static unsigned const   kind_shift = 62;
+    static uint64_t const   idle = 0;
+    static uint64_t const   pending = 1;
+    static uint64_t const   granted = 2;
+    static uint64_t const   failed = 3;
+
+    struct record {
+        std::atomic<bool>     active_;
+        record*               next_;
+        std::atomic<uint64_t> state_[2];
+        uint64_t              index_; // 1-based, 0 until first used
+        unsigned              countdown_;
+        size_t                next_check_;
+
+        record() : active_(false), next_(nullptr), index_(0)
+            , countdown_(help_delay), next_check_(0)
+        {
+            state_[enq].store(0, std::memory_order_relaxed);
+            state_[deq].store(0, std::memory_order_relaxed);
+        }
+
+        // the states stay, the next thread's requests continue the seqs.
+        void release() {}
+    };
+
+    // the calling thread's record for the length of one operation.
+    struct local_record {
+        mpmc_wait_free_queue& queue_;
+        record* rec_;
+        bool owned_;
+
+        explicit local_record(mpmc_wait_free_queue& q)
+            : queue_(q), rec_(q.records_.local(owned_))
+        {
+            if (!rec_->index_) {
+                q.add_record(rec_);
+            }
+        }
+
+        ~local_record()
+        {
+            if (owned_) {
+                thread_records<record>::release(rec_);
+            }
+        }
+    };
+
+    static size_t const     cacheline_size = 64;
+    typedef char            cacheline_pad_t [cacheline_size];
+
+    cacheline_pad_t         pad0_;
+    allocation_t            allocation_;
+    cell_t *const           buffer_;
+    size_t const            buffer_mask_ = buffer_size-1;
+    thread_records<record>  records_;
+    std::atomic<record*>    table_[max_records];
+    std::atomic<size_t>     table_size_;
+    cacheline_pad_t         pad1_;
+    std::atomic<uint64_t>   enqueue_pos_;
+    cacheline_pad_t         pad2_;
+    std::atomic<uint64_t>   dequeue_pos_;
+    cacheline_pad_t         pad3_;
+
+    static uint64_t state(uint64_t kind, uint64_t seq, uint64_t pos) {
+        return kind << kind_shift | seq << seq_shift | pos;
+    }
+    static uint64_t kind_of(uint64_t w) { return w >> kind_shift; }
+    static uint64_t seq_of(uint64_t w) { return (w >> seq_shift) & seq_mask; }
+    static uint64_t pos_of(uint64_t w) { return w & pos_mask; }
+    static uint64_t owner_of(uint64_t e) { return (e >> owner_shift) & owner_mask; }
+
+    // a - b for positions modulo 2^40.
+    static int64_t dif(uint64_t a, uint64_t b) {
+        return (int64_t)((a - b) << (64 - pos_bits)) >> (64 - pos_bits);
+    }
+
+    // position word after `e': pos + 1, no reservation.
+    static uint64_t next(uint64_t e) {
+        return (e & closed_bit_) | ((e + 1) & pos_mask);
+    }
+
+    std::atomic<uint64_t>& position(side_t side) {
+        return side == enq ? enqueue_pos_ : dequeue_pos_;
+    }
+
+    // 0 if the cell at `pos' is ready for `side', below 0 if the queue is
+    // full (empty), above 0 if `pos' is already taken.
+    int64_t probe(side_t side, uint64_t pos) {
+        cell_t* cell = &buffer_[pos & buffer_mask_];
+        uint64_t seq = cell->sequence_.load(std::memory_order_acquire);
+        return dif(seq, pos + side);
+    }
+
+    void add_record(record* r) {
+        size_t i = table_size_.fetch_add(1, std::memory_order_relaxed);
+        if (i >= max_records) {
+            table_size_.fetch_sub(1, std::memory_order_relaxed);
+            throw std::length_error("mpmc_wait_free_queue: too many threads");
+        }
+        r->index_ = i + 1;
+        table_[i].store(r, std::memory_order_release);
+    }
+
+    // grant or drop the reservation in `e'.
+    void resolve(side_t side, uint64_t e) {
+        record* r = table_[owner_of(e) - 1].load(std::memory_order_acquire);
+        uint64_t seq = (e >> seq_shift) & seq_mask;
+        uint64_t pos = pos_of(e);
+        uint64_t grant = state(granted, seq, pos);
+        uint64_t w = r->state_[side].load(std::memory_order_acquire);
+        if (kind_of(w) == pending && seq_of(w) == seq && dif(pos, pos_of(w)) >= 0) {
+            if (r->state_[side].compare_exchange_strong(w, grant,
+                        std::memory_order_acq_rel, std::memory_order_acquire)) {
+                w = grant;
+            }
+        }
+        uint64_t to = w == grant ? next(e) : e & (closed_bit_ | pos_mask);
+        position(side).compare_exchange_strong(e, to,
+                std::memory_order_acq_rel, std::memory_order_relaxed);
+    }
+
+    // run `r's pending request on `side' to completion.
+    void help(side_t side, record* r) {
+        std::atomic<uint64_t>& pos_word = position(side);
+        for (;;) {
+            uint64_t w = r->state_[side].load(std::memory_order_acquire);
+            if (kind_of(w) != pending) {
+                return;
+            }
+            uint64_t e = pos_word.load(std::memory_order_acquire);
+            if (owner_of(e)) {
+                resolve(side, e);
+                continue;
+            }
+            int64_t d = probe(side, pos_of(e));
+            if (d == 0 && !(e & closed_bit_)) {
+                uint64_t reserved = e | r->index_ << owner_shift | seq_of(w) << seq_shift;
+                pos_word.compare_exchange_strong(e, reserved,
+                        std::memory_order_acq_rel, std::memory_order_relaxed);
+            } else if (d < 0 || (e & closed_bit_)) {
+                r->state_[side].compare_exchange_strong(w, state(failed, seq_of(w), 0),
+                        std::memory_order_acq_rel, std::memory_order_relaxed);
+            }
+        }
+    }
+
+    void help_others(record* r) {
+        if (--r->countdown_) {
+            return;
+        }
+        r->countdown_ = help_delay;
+        size_t n = table_size_.load(std::memory_order_acquire);
+        record* o = table_[r->next_check_++ % n].load(std::memory_order_acquire);
+        if (o && o != r) {
+            help(enq, o);
+            help(deq, o);
+        }
+    }
+
+    // claim the next position on `side' for the calling thread, false if
+    // the queue is full (empty) or closed.
+    bool claim(side_t side, record* r, uint64_t& pos) {
+        std::atomic<uint64_t>& pos_word = position(side);
+        uint64_t e = pos_word.load(std::memory_order_acquire);
+        for (unsigned i = 0; i != max_fast_tries; ++i) {
+            if (owner_of(e)) {
+                resolve(side, e);
+                e = pos_word.load(std::memory_order_acquire);
+                continue;
+            }
+            if (e & closed_bit_) {
+                return false;
+            }
+            pos = pos_of(e);
+            int64_t d = probe(side, pos);
+            if (d == 0) {
+                if (pos_word.compare_exchange_weak(e, next(e),
+                            std::memory_order_acq_rel, std::memory_order_acquire)) {
+                    return true;
+                }
+            } else if (d < 0) {
+                return false;
+            } else {
+                e = pos_word.load(std::memory_order_acquire);
+            }
+        }
+
+        uint64_t seq = (seq_of(r->state_[side].load(std::memory_order_relaxed)) + 1) & seq_mask;
+        uint64_t start = pos_of(pos_word.load(std::memory_order_acquire));
+        r->state_[side].store(state(pending, seq, start), std::memory_order_release);
+        help(side, r);
+        uint64_t w = r->state_[side].load(std::memory_order_acquire);
+        if (kind_of(w) == failed) {
+            return false;
+        }
+        pos = pos_of(w);
+        // the reservation has to be gone before the next request of this
+        // record, or it would be dropped under a granted position.
+        uint64_t reserved = r->index_ << owner_shift | seq << seq_shift | pos;
+        e = pos_word.load(std::memory_order_acquire);
+        while ((e & ~closed_bit_) == reserved &&
+                !pos_word.compare_exchange_weak(e, next(e),
+                    std::memory_order_acq_rel, std::memory_order_acquire)) {
+        }
+        return true;
+    }
+
+public:
+    static_assert(
+            (buffer_size >= 2) && ((buffer_size & (buffer_size - 1)) == 0),
+            "bad buffer size, no room for mask");
+    static_assert(buffer_size <= ((size_t)1 << (pos_bits - 2)),
+            "buffer size out of the position range");
+    mpmc_wait_free_queue(mpmc_wait_free_queue const&) = delete;
+    void operator = (mpmc_wait_free_queue const&) = delete;
+
+    explicit mpmc_wait_free_queue(allocation_t const& allocation = allocation_t())
+        : allocation_(allocation)
+        , buffer_(static_cast<cell_t*>(allocation_.allocate(sizeof(cell_t) * buffer_size)))
+        , table_size_(0)
+    {
+        for (size_t i = 0; i != buffer_size; i += 1) {
+            new (&buffer_[i]) cell_t;
+            buffer_[i].sequence_.store(i, std::memory_order_relaxed);
+        }
+        for (size_t i = 0; i != max_records; i += 1) {
+            table_[i].store(nullptr, std::memory_order_relaxed);
+        }
+        enqueue_pos_.store(0, std::memory_order_relaxed);
+        dequeue_pos_.store(0, std::memory_order_relaxed);
+    }
+
+    ~mpmc_wait_free_queue() {
+        for (size_t i = 0; i != buffer_size; i += 1) {
+            buffer_[i].~cell_t();
+        }
+        allocation_.deallocate(buffer_, sizeof(cell_t) * buffer_size);
+    }
+
+    allocation_t const& allocation() const { return allocation_; }
+
+    bool enqueue(T const& data) {
+        local_record l(*this);
+        help_others(l.rec_);
+        uint64_t pos;
+        if (!claim(enq, l.rec_, pos)) {
+            return false;
+        }
+        cell_t* cell = &buffer_[pos & buffer_mask_];
+        cell->data_ = data;
+        cell->sequence_.store(pos + 1, std::memory_order_release);
+        return true;
+    }
+
+    bool dequeue(T& data) {
+        local_record l(*this);
+        help_others(l.rec_);
+        uint64_t pos;
+        if (!claim(deq, l.rec_, pos)) {
+            return false;
+        }
+        cell_t* cell = &buffer_[pos & buffer_mask_];
+        data = cell->data_;
+        cell->sequence_.store(pos + buffer_mask_ + 1, std::memory_order_release);
+        return true;
+    }
+
+    size_t size_approx() const {
+        uint64_t deq = pos_of(dequeue_pos_.load(std::memory_order_relaxed));
+        uint64_t enq = pos_of(enqueue_pos_.load(std::memory_order_relaxed));
+        int64_t d = dif(enq, deq);
+        if (d < 0) {
+            return 0;
+        }
+        return (size_t)d > buffer_size ? buffer_size : (size_t)d;
+    }
+
+    bool empty() const {
+        return size_approx() == 0;
+    }
+
+    size_t capacity() const {
+        return buffer_size;
+    }
+
+    // like mpmc_bounded_queue::close(), requests announced before the close
+    // that were not granted a position yet fail.
+    void close() {
+        enqueue_pos_.fetch_or(closed_bit_, std::memory_order_acq_rel);
+    }
+
+    bool is_closed() const {
+        return (enqueue_pos_.load(std::memory_order_acquire) & closed_bit_) != 0;
+    }
+
+    bool closed() const {
+        uint64_t enq = enqueue_pos_.load(std::memory_order_acquire);
+        if (!(enq & closed_bit_)) {
+            return false;
+        }
+        return pos_of(dequeue_pos_.load(std::memory_order_acquire)) == pos_of(enq);
+    }
+};
+
+#endif /* end of MPMC_WAIT_FREE_QUEUE_H */
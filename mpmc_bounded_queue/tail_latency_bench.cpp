@@ -0,0 +1,116 @@
+/*
+ * per-operation latency of mpmc_bounded_queue and mpmc_wait_free_queue
+ * with thread_count threads on one ring.
+ *
+ * every thread enqueues and dequeues in turn, and every single enqueue()
+ * and dequeue() call is timed with rdtsc into a per-thread buffer that was
+ * written before the start. failed calls (empty queue) are timed as well.
+ * after the run all samples are sorted together and the percentiles up to
+ * p99.99 and the max are printed in cycles. on a box with fewer cores than
+ * threads the max is a preemption, the p99.99 is where the two queues
+ * differ.
+ */
+
+#include <algorithm>
+#include <iostream>
+#include <thread>
+#include <atomic>
+#include <vector>
+
+#include "mpmc_bounded_queue.h"
+#include "mpmc_wait_free_queue.h"
+
+static size_t const thread_count = 32;
+static size_t const ring_size = 1024;
+static size_t const iter_count = 50000;
+
+static std::atomic<bool> g_start{false};
+
+static inline uint64_t rdtsc() {
+    uint64_t lo, hi;
+    __asm__ volatile ("rdtsc"
+            : "=a" (lo), "=d"(hi) /*outputs */
+            : /* no input parameters */
+            : "%ebx", "%ecx", "memory"); /* clobbers */
+    return lo | (hi << 32);
+}
+
+template<typename queue_t>
+static void thread_func(queue_t& queue, std::vector<uint64_t>& samples) {
+    size_t n = 0;
+    int data;
+
+    while (!g_start.load(std::memory_order_relaxed)) {
+        std::this_thread::yield();
+    }
+
+    for (size_t iter = 0; iter != iter_count; ++iter) {
+        for (;;) {
+            uint64_t start = rdtsc();
+            bool ok = queue.enqueue((int)iter);
+            uint64_t end = rdtsc();
+            if (n != samples.size()) {
+                samples[n++] = end - start;
+            }
+            if (ok) {
+                break;
+            }
+            std::this_thread::yield();
+        }
+        for (;;) {
+            uint64_t start = rdtsc();
+            bool ok = queue.dequeue(data);
+            uint64_t end = rdtsc();
+            if (n != samples.size()) {
+                samples[n++] = end - start;
+            }
+            if (ok) {
+                break;
+            }
+            std::this_thread::yield();
+        }
+    }
+    samples.resize(n);
+}
+
+template<typename queue_t>
+static void run(char const* name) {
+    queue_t queue;
+    std::vector<std::vector<uint64_t> > samples(thread_count);
+    for (size_t i = 0; i != thread_count; ++i) {
+        samples[i].assign(iter_count * 4, 0); // room for some failed calls
+    }
+
+    g_start = false;
+    std::vector<std::thread> threads;
+    for (size_t i = 0; i != thread_count; ++i) {
+        threads.push_back(std::thread(thread_func<queue_t>, std::ref(queue), std::ref(samples[i])));
+    }
+    g_start = true;
+    for (size_t i = 0; i != thread_count; ++i) {
+        threads[i].join();
+    }
+
+    std::vector<uint64_t> all;
+    for (size_t i = 0; i != thread_count; ++i) {
+        all.insert(all.end(), samples[i].begin(), samples[i].end());
+    }
+    std::sort(all.begin(), all.end());
+    size_t n = all.size();
+    std::cout << name
+        << " threads=" << thread_count
+        << " p50=" << all[n / 2]
+        << " p99=" << all[n / 100 * 99]
+        << " p99.9=" << all[n / 1000 * 999]
+        << " p99.99=" << all[n / 10000 * 9999]
+        << " max=" << all[n - 1]
+        << " cycles/op" << std::endl;
+}
+
+int main() {
+    for (int i = 0; i != 2; ++i) {
+        run<mpmc_bounded_queue<int, ring_size> >("mpmc_bounded_queue  ");
+        run<mpmc_wait_free_queue<int, ring_size> >("mpmc_wait_free_queue");
+    }
+    return 0;
+}
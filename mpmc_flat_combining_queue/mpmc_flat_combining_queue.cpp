@@ -0,0 +1,103 @@
+/*
+ * contention benchmark: every thread enqueues and dequeues in turn on one
+ * shared queue, with a fixed total amount of work, for 1 to max_threads
+ * threads (more threads than cores on purpose, that is contention too).
+ * prints cycles per operation for the flat-combining queue next to the
+ * other mpmc queues of this tree.
+ */
+
+#include <iostream>
+#include <functional>
+#include <thread>
+#include <atomic>
+#include <vector>
+#include <xmmintrin.h> // for _mm_pause
+
+#include "mpmc_flat_combining_queue.h"
+#include "../mpmc_bounded_queue/mpmc_bounded_queue.h"
+#include "../mpmc_bounded_queue/mpmc_wait_free_queue.h"
+#include "../mpmc_segmented_queue/mpmc_segmented_queue.h"
+#include "../mpmc_unbounded_queue/mpmc_queue.h"
+
+static size_t const batch_size = 1;
+static size_t const iter_count = 1000000;
+static size_t const queue_size = 1024;
+static size_t const max_threads = 32;
+
+static std::atomic<bool> volatile g_start{0};
+
+template<typename queue_t>
+static void thread_func(queue_t &queue, size_t iters) {
+    int data;
+
+    std::hash<std::thread::id> hasher;
+    std::srand((unsigned)time(0) + (unsigned)hasher(std::this_thread::get_id()));
+    size_t pause = std::rand() % 1000;
+
+    while (g_start == 0) {
+        std::this_thread::yield();
+    }
+
+    for (size_t i = 0; i != pause; i += 1) {
+        _mm_pause();
+    }
+
+    for (size_t iter = 0; iter != iters; ++iter) {
+        for (size_t i = 0; i != batch_size; i += 1) {
+            while (!queue.enqueue(i)) {
+                std::this_thread::yield();
+            }
+        }
+        for (size_t i = 0; i != batch_size; i += 1) {
+            while (!queue.dequeue(data)) {
+                std::this_thread::yield();
+            }
+        }
+    }
+}
+
+static inline uint64_t rdtsc() {
+    uint64_t lo, hi;
+    __asm__ volatile ("rdtsc"
+            : "=a" (lo), "=d"(hi) /*outputs */
+            : /* no input parameters */
+            : "%ebx", "%ecx", "memory"); /* clobbers */
+    return lo | (hi << 32);
+}
+
+template<typename queue_t>
+static uint64_t run(size_t thread_count) {
+    queue_t queue;
+    size_t iters = iter_count / thread_count;
+    g_start = 0;
+
+    std::vector<std::thread> threads;
+    for (size_t i = 0; i != thread_count; ++i) {
+        threads.push_back(std::thread(thread_func<queue_t>, std::ref(queue), iters));
+    }
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+    uint64_t start = rdtsc();
+    g_start = 1;
+
+    for (size_t i = 0; i != thread_count; ++i) {
+        threads[i].join();
+    }
+
+    uint64_t end = rdtsc();
+    return (end - start) / (batch_size * iters * 2 * thread_count);
+}
+
+int main() {
+    for (size_t threads = 1; threads <= max_threads; threads *= 2) {
+        std::cout << "threads=" << threads
+            << " cycles/op"
+            << " bounded=" << run<mpmc_bounded_queue<int, queue_size> >(threads)
+            << " wait_free=" << run<mpmc_wait_free_queue<int, queue_size> >(threads)
+            << " segmented=" << run<mpmc_segmented_queue<int> >(threads)
+            << " unbounded=" << run<mpmc_queue<int> >(threads)
+            << " flat_combining=" << run<mpmc_flat_combining_queue<int, queue_size> >(threads)
+            << std::endl;
+    }
+}
@@ -0,0 +1,191 @@
+#ifndef MPMC_FLAT_COMBINING_QUEUE_H
+#define MPMC_FLAT_COMBINING_QUEUE_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <thread>
+
+#include "../common/thread_records.h"
+
+/*
+ * bounded multi-producer/multi-consumer queue by flat combining (Hendler,
+ * Incze, Shavit, Tzafrir).
+ *
+ * every thread owns a publication record (../common/thread_records.h). an
+ * operation writes its request into the record and then either waits for
+ * it to be served or takes the combiner lock. the combiner walks the
+ * publication list, runs every pending enqueue and dequeue against a plain
+ * array ring that only it touches, and hands each result back through the
+ * record. under heavy contention one thread does the work of many with the
+ * ring and the list hot in its cache, and the only contended line is the
+ * lock, taken once per batch instead of a CAS per element.
+ *
+ * same interface as mpmc_bounded_queue; enqueue fails when the ring is
+ * full or the queue is closed, dequeue when it is empty.
+ */
+template<typename T, size_t buffer_size>
+class mpmc_flat_combining_queue
+{
+public:
+    static unsigned const   combine_passes = 4;
+    static unsigned const   spin_limit = 64;
+
+private:
+    enum request_t { none = 0, enq = 1, deq = 2 };
+
+    struct record {
+        std::atomic<bool>     active_;
+        record*               next_;
+        std::atomic<unsigned> request_;
+        T                     value_;  // argument of enqueue, result of dequeue
+        bool                  ok_;
+
+        record() : active_(false), next_(nullptr), request_(none), value_(), ok_(false) {}
+
+        // requests are always served before the owner returns.
+        void release() {}
+    };
+
+    static size_t const     cacheline_size = 64;
+    typedef char            cacheline_pad_t [cacheline_size];
+
+    cacheline_pad_t         pad0_;
+    thread_records<record>  records_;
+    T *const                buffer_;
+    size_t const            buffer_mask_ = buffer_size-1;
+    cacheline_pad_t         pad1_;
+    std::atomic<bool>       lock_;
+    cacheline_pad_t         pad2_;
+    // combiner state, the counters are atomic only for size_approx().
+    std::atomic<size_t>     enqueue_pos_;
+    std::atomic<size_t>     dequeue_pos_;
+    std::atomic<bool>       closed_;
+    cacheline_pad_t         pad3_;
+
+    void serve(record* r, unsigned request) {
+        size_t enq_pos = enqueue_pos_.load(std::memory_order_relaxed);
+        size_t deq_pos = dequeue_pos_.load(std::memory_order_relaxed);
+        if (request == enq) {
+            r->ok_ = enq_pos - deq_pos != buffer_size &&
+                !closed_.load(std::memory_order_acquire);
+            if (r->ok_) {
+                buffer_[enq_pos & buffer_mask_] = r->value_;
+                enqueue_pos_.store(enq_pos + 1, std::memory_order_relaxed);
+            }
+        } else {
+            r->ok_ = enq_pos != deq_pos;
+            if (r->ok_) {
+                r->value_ = buffer_[deq_pos & buffer_mask_];
+                dequeue_pos_.store(deq_pos + 1, std::memory_order_relaxed);
+            }
+        }
+    }
+
+    // caller holds lock_.
+    void combine() {
+        for (unsigned pass = 0; pass != combine_passes; ++pass) {
+            bool served = false;
+            for (record* r = records_.head(); r; r = r->next_) {
+                unsigned request = r->request_.load(std::memory_order_acquire);
+                if (request == none) {
+                    continue;
+                }
+                serve(r, request);
+                r->request_.store(none, std::memory_order_release); // synchronize with owner
+                served = true;
+            }
+            if (!served) {
+                break;
+            }
+        }
+    }
+
+    bool apply(request_t request, T& value) {
+        bool owned;
+        record* r = records_.local(owned);
+        if (request == enq) {
+            r->value_ = value;
+        }
+        r->request_.store(request, std::memory_order_release); // synchronize with combiner
+
+        for (unsigned spins = 0; ; ) {
+            if (r->request_.load(std::memory_order_acquire) == none) {
+                break;
+            }
+            if (!lock_.load(std::memory_order_relaxed) &&
+                    !lock_.exchange(true, std::memory_order_acquire)) {
+                combine(); // serves our own request too
+                lock_.store(false, std::memory_order_release);
+                break;
+            }
+            if (++spins == spin_limit) {
+                spins = 0;
+                std::this_thread::yield();
+            }
+        }
+
+        bool ok = r->ok_;
+        if (ok && request == deq) {
+            value = r->value_;
+        }
+        if (owned) {
+            thread_records<record>::release(r);
+        }
+        return ok;
+    }
+
+public:
+    static_assert(
+            (buffer_size >= 2) && ((buffer_size & (buffer_size - 1)) == 0),
+            "bad buffer size, no room for mask");
+    mpmc_flat_combining_queue(mpmc_flat_combining_queue const&) = delete;
+    void operator = (mpmc_flat_combining_queue const&) = delete;
+
+    mpmc_flat_combining_queue()
+        : buffer_(new T[buffer_size]), lock_(false)
+        , enqueue_pos_(0), dequeue_pos_(0), closed_(false) {}
+
+    ~mpmc_flat_combining_queue() {
+        delete[] buffer_;
+    }
+
+    bool enqueue(T const& data) {
+        T value = data;
+        return apply(enq, value);
+    }
+
+    bool dequeue(T& data) {
+        return apply(deq, data);
+    }
+
+    size_t size_approx() const {
+        size_t deq_pos = dequeue_pos_.load(std::memory_order_relaxed);
+        size_t enq_pos = enqueue_pos_.load(std::memory_order_relaxed);
+        return enq_pos > deq_pos ? enq_pos - deq_pos : 0;
+    }
+
+    bool empty() const {
+        return size_approx() == 0;
+    }
+
+    size_t capacity() const {
+        return buffer_size;
+    }
+
+    // enqueues served after this fail, dequeues keep draining.
+    void close() {
+        closed_.store(true, std::memory_order_release);
+    }
+
+    bool is_closed() const {
+        return closed_.load(std::memory_order_acquire);
+    }
+
+    bool closed() const {
+        return closed_.load(std::memory_order_acquire) &&
+            dequeue_pos_.load(std::memory_order_acquire) == enqueue_pos_.load(std::memory_order_acquire);
+    }
+};
+
+#endif /* end of MPMC_FLAT_COMBINING_QUEUE_H */
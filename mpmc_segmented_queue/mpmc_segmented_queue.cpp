@@ -0,0 +1,120 @@
+#include <iostream>
+#include <functional>
+#include <thread>
+#include <atomic>
+#include <array>
+#include <xmmintrin.h> // for _mm_pause
+
+#include "mpmc_segmented_queue.h"
+#include "../mpmc_bounded_queue/mpmc_bounded_queue.h"
+#include "../common/high_watermark.h"
+
+static size_t const thread_count = 4;
+static size_t const iter_count = 500000;
+
+static std::atomic<bool> volatile g_start{0};
+static high_watermark g_depth;
+
+template<typename T, size_t N>
+static inline bool try_enqueue(mpmc_segmented_queue<T, N>& queue, T const& v) {
+    return queue.enqueue(v);
+}
+
+template<typename T, size_t N>
+static inline bool try_enqueue(mpmc_bounded_queue<T, N>& queue, T const& v) {
+    return queue.enqueue(v);
+}
+
+template<typename queue_t>
+static void thread_func(queue_t &queue, size_t batch_size, std::atomic<long>& sum) {
+    int data;
+    long local = 0;
+    unsigned samples = 0; // sample_every() counter of this thread
+
+    std::hash<std::thread::id> hasher;
+    std::srand((unsigned)time(0) + (unsigned)hasher(std::this_thread::get_id()));
+    size_t pause = std::rand() % 1000;
+
+    while (g_start == 0) {
+        std::this_thread::yield();
+    }
+
+    for (size_t i = 0; i != pause; i += 1) {
+        _mm_pause();
+    }
+
+    for (size_t iter = 0; iter != iter_count / batch_size; ++iter) {
+        for (size_t i = 0; i != batch_size; i += 1) {
+            while (!try_enqueue(queue, (int)i)) {
+                std::this_thread::yield();
+            }
+            local += i;
+            g_depth.sample_every<64>(queue, samples);
+        }
+        for (size_t i = 0; i != batch_size; i += 1) {
+            while (!queue.dequeue(data)) {
+                std::this_thread::yield();
+            }
+            local -= data;
+        }
+    }
+    sum.fetch_add(local, std::memory_order_relaxed);
+}
+
+static inline uint64_t rdtsc() {
+    uint64_t lo, hi;
+    __asm__ volatile ("rdtsc"
+            : "=a" (lo), "=d"(hi) /*outputs */
+            : /* no input parameters */
+            : "%ebx", "%ecx", "memory"); /* clobbers */
+    return lo | (hi << 32);
+}
+
+template<typename queue_t>
+static void run(char const* name, size_t batch_size) {
+    queue_t* queue = new queue_t;
+    std::atomic<long> sum{0};
+    g_start = 0;
+    g_depth.reset();
+
+    std::array<std::thread, thread_count> threads;
+    for (size_t i = 0; i != thread_count; ++i) {
+        threads[i] = std::thread(thread_func<queue_t>,
+                std::ref(*queue), batch_size, std::ref(sum));
+    }
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+    uint64_t start = rdtsc();
+    g_start = 1;
+
+    for (size_t i = 0; i != thread_count; ++i) {
+        threads[i].join();
+    }
+
+    uint64_t end = rdtsc();
+    uint64_t time = end - start;
+    std::cout << name << " batch=" << batch_size
+        << " cycles/op="
+        << time / ((iter_count / batch_size) * batch_size * 2 * thread_count)
+        << " max_depth~" << g_depth.get()
+        << (sum == 0 ? "" : " MISMATCH")
+        << std::endl;
+
+    int data;
+    if (queue->dequeue(data)) {
+        std::cout << "queue not empty at the end" << std::endl;
+    }
+    delete queue;
+}
+
+int main() {
+    // the bounded queue has 4096 cells, a batch that doesn't fit makes it
+    // spin on a full queue, the segmented one just grows.
+    size_t const batches[] = { 1, 64, 1024 };
+    for (size_t b : batches) {
+        run<mpmc_bounded_queue<int, 4096> >("bounded  ", b);
+        run<mpmc_segmented_queue<int, 1024> >("segmented", b);
+    }
+    run<mpmc_segmented_queue<int, 1024> >("segmented", 10000);
+}
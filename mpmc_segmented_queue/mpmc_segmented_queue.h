@@ -0,0 +1,326 @@
+#ifndef MPMC_SEGMENTED_QUEUE_H
+#define MPMC_SEGMENTED_QUEUE_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+#include "../mpmc_unbounded_queue/proxy_collector.h"
+
+/*
+ * unbounded multi-producer/multi-consumer queue made of a linked list of
+ * array segments. inside a segment the cells follow the sequence protocol
+ * of mpmc_bounded_queue, except that a segment is used exactly once: the
+ * positions never wrap, a full segment makes producers link a new one and
+ * an exhausted segment is unlinked by consumers.
+ *
+ * every operation runs inside a proxy collector region, so an unlinked
+ * segment is only reset and pushed to the free list once no thread can
+ * still be looking at it. the free list is popped inside the region too,
+ * which is what keeps its pop ABA-free: a segment we saw on the list can't
+ * come back to the list before we leave the region.
+ */
+template<typename T, size_t segment_size = 1024>
+class mpmc_segmented_queue
+{
+private:
+    struct cell_t {
+        std::atomic<size_t> sequence_;
+        T                   data_;
+    };
+
+    static size_t const     cacheline_size = 64;
+    typedef char            cacheline_pad_t [cacheline_size];
+
+    struct segment : proxy::defer_node {
+        mpmc_segmented_queue*   owner_;
+        std::atomic<size_t>     enqueue_pos_;
+        cacheline_pad_t         pad0_;
+        std::atomic<size_t>     dequeue_pos_;
+        cacheline_pad_t         pad1_;
+        std::atomic<segment*>   next_;
+        std::atomic<segment*>   free_next_;
+        std::atomic<size_t>     index_; // position in the chain, for size_approx
+        cacheline_pad_t         pad2_;
+        cell_t                  cells_[segment_size];
+
+        explicit segment(mpmc_segmented_queue* owner) : owner_(owner) { reset(); }
+
+        void reset() {
+            for (size_t i = 0; i != segment_size; i += 1) {
+                cells_[i].sequence_.store(i, std::memory_order_relaxed);
+            }
+            enqueue_pos_.store(0, std::memory_order_relaxed);
+            dequeue_pos_.store(0, std::memory_order_relaxed);
+            next_.store(nullptr, std::memory_order_relaxed);
+            free_next_.store(nullptr, std::memory_order_relaxed);
+            index_.store(0, std::memory_order_relaxed);
+        }
+    };
+
+    cacheline_pad_t         pad0_;
+    std::atomic<segment*>   tail_; // producers
+    cacheline_pad_t         pad1_;
+    std::atomic<segment*>   head_; // consumers
+    cacheline_pad_t         pad2_;
+    std::atomic<segment*>   free_;
+    std::atomic<bool>       closed_;
+    cacheline_pad_t         pad3_;
+    mutable proxy           proxy_;
+
+    // close() sets closed_bit_ in enqueue_pos_ of the live segments and
+    // seals the end of the chain with sealed() so no segment can be linked
+    // after it.
+    static size_t const     closed_bit_ = ~(~(size_t)0 >> 1);
+
+    static segment* sealed() {
+        return reinterpret_cast<segment*>(uintptr_t(1));
+    }
+
+public:
+    static_assert(segment_size >= 2, "bad segment size");
+    mpmc_segmented_queue(mpmc_segmented_queue const&) = delete;
+    void operator = (mpmc_segmented_queue const&) = delete;
+
+public:
+    mpmc_segmented_queue()
+    {
+        segment* s = new segment(this);
+        tail_.store(s, std::memory_order_relaxed);
+        head_.store(s, std::memory_order_relaxed);
+        free_.store(nullptr, std::memory_order_relaxed);
+        closed_.store(false, std::memory_order_relaxed);
+    }
+
+    ~mpmc_segmented_queue() {
+        // no thread is inside a region any more, so closing the current
+        // batch runs every deferred recycle and the segments are either
+        // linked from head_ or sitting on the free list.
+        proxy_.flush();
+        segment* s = head_.load(std::memory_order_relaxed);
+        while (s && s != sealed()) {
+            segment* next = s->next_.load(std::memory_order_relaxed);
+            delete s;
+            s = next;
+        }
+        s = free_.load(std::memory_order_relaxed);
+        while (s) {
+            segment* next = s->free_next_.load(std::memory_order_relaxed);
+            delete s;
+            s = next;
+        }
+    }
+
+    bool enqueue(T const& data) {
+        proxy::collector* c = proxy_.acquire();
+
+        cell_t* cell;
+        segment* s = tail_.load(std::memory_order_acquire);
+        size_t pos = s->enqueue_pos_.load(std::memory_order_relaxed);
+        for (;;) {
+            if (pos & closed_bit_) {
+                proxy_.release(c);
+                return false;
+            }
+            if (pos < segment_size) {
+                cell = &s->cells_[pos];
+                size_t seq = cell->sequence_.load(std::memory_order_acquire);
+                intptr_t dif = (intptr_t)seq - (intptr_t)pos;
+                if (dif == 0) {
+                    if (s->enqueue_pos_.compare_exchange_weak(
+                                pos, pos + 1, std::memory_order_relaxed)) {
+                        break;
+                    }
+                } else {
+                    pos = s->enqueue_pos_.load(std::memory_order_relaxed);
+                }
+                continue;
+            }
+
+            // segment is full, move to the next one, linking it if needed.
+            segment* next = s->next_.load(std::memory_order_acquire);
+            if (!next) {
+                segment* n = alloc_segment();
+                n->index_.store(s->index_.load(std::memory_order_relaxed) + 1,
+                        std::memory_order_relaxed);
+                if (s->next_.compare_exchange_strong(
+                            next, n, std::memory_order_acq_rel)) {
+                    next = n;
+                } else {
+                    // never published, but it still can't go straight
+                    // back: a reader that saw it on the free list before we
+                    // popped it may be about to CAS its stale successor in.
+                    retire(c, n);
+                }
+            }
+            if (next == sealed()) {
+                proxy_.release(c);
+                return false;
+            }
+            tail_.compare_exchange_strong(s, next, std::memory_order_acq_rel);
+            s = tail_.load(std::memory_order_acquire);
+            pos = s->enqueue_pos_.load(std::memory_order_relaxed);
+        }
+
+        cell->data_ = data;
+        cell->sequence_.store(pos + 1, std::memory_order_release);
+
+        proxy_.release(c);
+        return true;
+    }
+
+    bool dequeue(T& data) {
+        proxy::collector* c = proxy_.acquire();
+
+        cell_t* cell;
+        segment* s = head_.load(std::memory_order_acquire);
+        size_t pos = s->dequeue_pos_.load(std::memory_order_relaxed);
+        for (;;) {
+            if (pos < segment_size) {
+                cell = &s->cells_[pos];
+                size_t seq = cell->sequence_.load(std::memory_order_acquire);
+                intptr_t dif = (intptr_t)seq - (intptr_t)(pos + 1);
+                if (dif == 0) {
+                    if (s->dequeue_pos_.compare_exchange_weak(
+                                pos, pos + 1, std::memory_order_relaxed)) {
+                        break;
+                    }
+                } else if (dif < 0) {
+                    proxy_.release(c);
+                    return false;
+                } else {
+                    pos = s->dequeue_pos_.load(std::memory_order_relaxed);
+                }
+                continue;
+            }
+
+            // segment is exhausted, unlink it if there is a successor.
+            segment* next = s->next_.load(std::memory_order_acquire);
+            if (!next || next == sealed()) {
+                proxy_.release(c);
+                return false;
+            }
+            // producers may not have swung tail_ yet; do it for them, so
+            // nobody entering after the retire can find `s' through tail_.
+            segment* t = s;
+            tail_.compare_exchange_strong(t, next, std::memory_order_acq_rel);
+            if (head_.compare_exchange_strong(s, next, std::memory_order_acq_rel)) {
+                retire(c, s);
+                s = next;
+            }
+            pos = s->dequeue_pos_.load(std::memory_order_relaxed);
+        }
+
+        data = cell->data_;
+
+        proxy_.release(c);
+        return true;
+    }
+
+    // wait-free depth hint. it reads segments without entering the proxy
+    // region; that is fine because segments are only ever recycled, never
+    // freed, while the queue is alive, so a stale segment just gives a
+    // stale number which is clamped below.
+    size_t size_approx() const {
+        segment* h = head_.load(std::memory_order_acquire);
+        size_t deq = h->index_.load(std::memory_order_relaxed) * segment_size
+            + clamp(h->dequeue_pos_.load(std::memory_order_relaxed));
+        segment* t = tail_.load(std::memory_order_acquire);
+        size_t enq = t->index_.load(std::memory_order_relaxed) * segment_size
+            + clamp(t->enqueue_pos_.load(std::memory_order_relaxed) & ~closed_bit_);
+        return enq > deq ? enq - deq : 0;
+    }
+
+    bool empty() const {
+        return size_approx() == 0;
+    }
+
+    // enqueues fail from now on, dequeues keep draining what was enqueued
+    // before. only the segments from tail_ on can still take elements, so
+    // this is O(1) apart from segments linked concurrently.
+    void close() {
+        proxy::collector* c = proxy_.acquire();
+        segment* s = tail_.load(std::memory_order_acquire);
+        for (;;) {
+            s->enqueue_pos_.fetch_or(closed_bit_, std::memory_order_acq_rel);
+            segment* next = nullptr;
+            if (s->next_.compare_exchange_strong(
+                        next, sealed(), std::memory_order_acq_rel) ||
+                    next == sealed()) {
+                break;
+            }
+            s = next;
+        }
+        closed_.store(true, std::memory_order_release);
+        proxy_.release(c);
+    }
+
+    bool is_closed() const {
+        return closed_.load(std::memory_order_acquire);
+    }
+
+    // true once the queue is closed and everything enqueued before the
+    // close has been dequeued. it stays true.
+    bool closed() const {
+        if (!closed_.load(std::memory_order_acquire)) {
+            return false;
+        }
+        proxy::collector* c = proxy_.acquire();
+        bool drained;
+        segment* s = head_.load(std::memory_order_acquire);
+        for (;;) {
+            size_t enq = s->enqueue_pos_.load(std::memory_order_acquire) & ~closed_bit_;
+            size_t deq = clamp(s->dequeue_pos_.load(std::memory_order_acquire));
+            if (deq < clamp(enq)) {
+                drained = false;
+                break;
+            }
+            segment* next = s->next_.load(std::memory_order_acquire);
+            if (!next || next == sealed()) {
+                drained = true;
+                break;
+            }
+            s = next;
+        }
+        proxy_.release(c);
+        return drained;
+    }
+
+private:
+    static size_t clamp(size_t pos) {
+        return pos < segment_size ? pos : segment_size;
+    }
+
+    // must be called inside a proxy region, see the comment at the top.
+    segment* alloc_segment() {
+        segment* s = free_.load(std::memory_order_acquire);
+        while (s) {
+            segment* next = s->free_next_.load(std::memory_order_relaxed);
+            if (free_.compare_exchange_weak(
+                        s, next, std::memory_order_acquire)) {
+                return s;
+            }
+        }
+        return new segment(this);
+    }
+
+    void push_free(segment* s) {
+        segment* head = free_.load(std::memory_order_relaxed);
+        do {
+            s->free_next_.store(head, std::memory_order_relaxed);
+        } while (!free_.compare_exchange_weak(
+                    head, s, std::memory_order_release));
+    }
+
+    static void recycle(proxy::defer_node* n) {
+        segment* s = static_cast<segment*>(n);
+        s->reset();
+        s->owner_->push_free(s);
+    }
+
+    void retire(proxy::collector* c, segment* s) {
+        proxy_.defer_recycle(c, s, &mpmc_segmented_queue::recycle);
+    }
+};
+
+#endif /* end of MPMC_SEGMENTED_QUEUE_H */
@@ -0,0 +1,108 @@
+#include <iostream>
+#include <functional>
+#include <thread>
+#include <atomic>
+#include <vector>
+#include <xmmintrin.h> // for _mm_pause
+
+#include "mpmc_sharded_queue.h"
+
+static size_t const batch_size = 1;
+static size_t const iter_count = 1000000;
+static size_t const queue_size = 1024;
+
+static std::atomic<bool> volatile g_start{0};
+
+typedef mpmc_bounded_queue<int, queue_size> single_queue_t;
+typedef mpmc_sharded_queue<int, queue_size> sharded_queue_t;
+
+template<typename queue_t>
+static void thread_func(queue_t &queue, size_t iters) {
+    int data;
+
+    std::hash<std::thread::id> hasher;
+    std::srand((unsigned)time(0) + (unsigned)hasher(std::this_thread::get_id()));
+    size_t pause = std::rand() % 1000;
+
+    while (g_start == 0) {
+        std::this_thread::yield();
+    }
+
+    for (size_t i = 0; i != pause; i += 1) {
+        _mm_pause();
+    }
+
+    for (size_t iter = 0; iter != iters; ++iter) {
+        for (size_t i = 0; i != batch_size; i += 1) {
+            while (!queue.enqueue(i)) {
+                std::this_thread::yield();
+            }
+        }
+        for (size_t i = 0; i != batch_size; i += 1) {
+            while (!queue.dequeue(data)) {
+                std::this_thread::yield();
+            }
+        }
+    }
+}
+
+static inline uint64_t rdtsc() {
+    uint64_t lo, hi;
+    __asm__ volatile ("rdtsc"
+            : "=a" (lo), "=d"(hi) /*outputs */
+            : /* no input parameters */
+            : "%ebx", "%ecx", "memory"); /* clobbers */
+    return lo | (hi << 32);
+}
+
+// total work is fixed, so cycles/op should drop as threads are added for
+// as long as the queue scales.
+template<typename queue_t>
+static uint64_t run(queue_t& queue, size_t thread_count) {
+    size_t iters = iter_count / thread_count;
+    g_start = 0;
+
+    std::vector<std::thread> threads;
+    for (size_t i = 0; i != thread_count; ++i) {
+        threads.push_back(std::thread(thread_func<queue_t>, std::ref(queue), iters));
+    }
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+    uint64_t start = rdtsc();
+    g_start = 1;
+
+    for (size_t i = 0; i != thread_count; ++i) {
+        threads[i].join();
+    }
+
+    uint64_t end = rdtsc();
+    return (end - start) / (batch_size * iters * 2 * thread_count);
+}
+
+int main() {
+    size_t cores = std::thread::hardware_concurrency();
+    if (cores == 0) {
+        cores = 1;
+    }
+
+    for (size_t threads = 1; ; threads *= 2) {
+        if (threads > cores) {
+            threads = cores;
+        }
+
+        single_queue_t single;
+        sharded_queue_t by_cpu(cores, sharded_queue_t::by_cpu);
+        sharded_queue_t by_thread(threads, sharded_queue_t::by_thread);
+
+        std::cout << "threads=" << threads
+            << " single cycles/op=" << run(single, threads)
+            << " sharded(cpu) cycles/op=" << run(by_cpu, threads)
+            << " sharded(thread) cycles/op=" << run(by_thread, threads)
+            << std::endl;
+
+        if (threads == cores) {
+            break;
+        }
+    }
+}
@@ -0,0 +1,135 @@
+#ifndef MPMC_SHARDED_QUEUE_H
+#define MPMC_SHARDED_QUEUE_H
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+
+#ifdef __linux__
+#include <sched.h>
+#endif
+
+#include "../mpmc_bounded_queue/mpmc_bounded_queue.h"
+
+/*
+ * sharded multi-producer/multi-consumer queue: a front-end over N
+ * mpmc_bounded_queue shards so threads on different cpus don't all hit the
+ * same enqueue_pos_/dequeue_pos_.
+ *
+ * every thread has a home shard, picked from the cpu it runs on or from a
+ * per-thread index. producers enqueue to their home shard and only spill
+ * to the others when it is full; consumers drain their home shard first
+ * and then steal from the others, starting with the neighbour. order is
+ * FIFO per shard only, there is no order between shards.
+ */
+template<typename T, size_t shard_size>
+class mpmc_sharded_queue
+{
+public:
+    enum shard_select {
+        by_cpu,     // sched_getcpu(), falls back to by_thread without it
+        by_thread,  // round-robin index handed out at a thread's first call
+    };
+
+private:
+    typedef mpmc_bounded_queue<T, shard_size> shard_t;
+
+    std::unique_ptr<shard_t[]>  shards_;
+    size_t const                shard_count_;
+    shard_select const          select_;
+
+public:
+    mpmc_sharded_queue(mpmc_sharded_queue const&) = delete;
+    void operator = (mpmc_sharded_queue const&) = delete;
+
+    explicit mpmc_sharded_queue(size_t shard_count, shard_select select = by_cpu)
+        : shards_(new shard_t[shard_count ? shard_count : 1])
+        , shard_count_(shard_count ? shard_count : 1)
+        , select_(select)
+    {
+    }
+
+    bool enqueue(T const& data) {
+        size_t home = home_shard();
+        for (size_t i = 0; i != shard_count_; i += 1) {
+            if (shards_[(home + i) % shard_count_].enqueue(data)) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    bool dequeue(T& data) {
+        size_t home = home_shard();
+        for (size_t i = 0; i != shard_count_; i += 1) {
+            if (shards_[(home + i) % shard_count_].dequeue(data)) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    size_t size_approx() const {
+        size_t size = 0;
+        for (size_t i = 0; i != shard_count_; i += 1) {
+            size += shards_[i].size_approx();
+        }
+        return size;
+    }
+
+    bool empty() const {
+        for (size_t i = 0; i != shard_count_; i += 1) {
+            if (!shards_[i].empty()) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    void close() {
+        for (size_t i = 0; i != shard_count_; i += 1) {
+            shards_[i].close();
+        }
+    }
+
+    // shards are closed in order, the last one closes last.
+    bool is_closed() const {
+        return shards_[shard_count_ - 1].is_closed();
+    }
+
+    // closed and every shard drained, see mpmc_bounded_queue::closed().
+    bool closed() const {
+        for (size_t i = 0; i != shard_count_; i += 1) {
+            if (!shards_[i].closed()) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    size_t shard_count() const {
+        return shard_count_;
+    }
+
+    size_t home_shard() const {
+#ifdef __linux__
+        if (select_ == by_cpu) {
+            int cpu = sched_getcpu();
+            if (cpu >= 0) {
+                return (size_t)cpu % shard_count_;
+            }
+        }
+#endif
+        return thread_index() % shard_count_;
+    }
+
+private:
+    static size_t thread_index() {
+        static std::atomic<size_t> next_index{0};
+        static thread_local size_t index =
+            next_index.fetch_add(1, std::memory_order_relaxed);
+        return index;
+    }
+};
+
+#endif /* end of MPMC_SHARDED_QUEUE_H */
@@ -0,0 +1,266 @@
+#ifndef MPMC_QUEUE_H
+#define MPMC_QUEUE_H
+
+#include <atomic>
+#include <cassert>
+#include <cstddef>
+#include <memory>
+#include <type_traits>
+
+#include "proxy_collector.h"
+#include "../common/prefetch.h"
+
+/*
+ * reclaim_t is the reclamation scheme for dequeued nodes: proxy from
+ * proxy_collector.h (the default) or hazard_domain from
+ * hazard_pointer/hazard_pointer.h. dequeue protects the tail and its
+ * successor through a reclaim_t::guard and retires the old tail there.
+ *
+ * alloc_t allocates the nodes and is rebound to the node type. any
+ * std::allocator-compatible allocator that may be used from several
+ * threads at once works: std::allocator<T>, pool_allocator<T> from
+ * ../common/node_pool.h, arena_allocator<T> from ../common/node_arena.h
+ * or a pmr polymorphic_allocator over a synchronized resource. pass a
+ * stateful one to the constructor.
+ *
+ * T_prefetch makes the consumer that wins an element prefetch the node
+ * after it (../common/prefetch.h).
+ */
+template<typename T, typename reclaim_t = proxy, typename alloc_t = std::allocator<T>, bool T_prefetch = false>
+class mpmc_queue {
+    // nodes are freed from the reclamation callback, which only gets the
+    // node. an empty alloc_t is simply rebuilt there; a stateful one is
+    // reached through the queue, so then the node carries a back pointer.
+    static bool const stateless_alloc_ = std::is_empty<alloc_t>::value;
+    typedef std::integral_constant<bool, stateless_alloc_> stateless_tag;
+
+    struct no_owner {};
+    struct owner {
+        mpmc_queue* queue_;
+    };
+
+    struct node : defer_node, std::conditional<stateless_alloc_, no_owner, owner>::type {
+        std::atomic<node*> next_;
+        T volatile value_;
+        node(T value, node *next = nullptr) : value_(value)
+        {
+            next_.store(next, std::memory_order_relaxed);
+        }
+    };
+
+    std::atomic<node*> head_;
+    std::atomic<node*> tail_;
+
+    // depth counters, each on its own line so they don't bounce with
+    // head_/tail_ or with each other. enqueued_ counts reservations and
+    // carries the closed bit.
+    char pad0_[64];
+    std::atomic<size_t> enqueued_;
+    std::atomic<size_t> closed_count_; // enqueued_ at close(), open_ before
+    char pad1_[64];
+    std::atomic<size_t> dequeued_;
+    char pad2_[64];
+
+    static size_t const closed_bit_ = ~(~(size_t)0 >> 1);
+    static size_t const open_ = ~(size_t)0;
+
+    typedef typename std::allocator_traits<alloc_t>::template rebind_alloc<node> node_alloc_t;
+    typedef std::allocator_traits<node_alloc_t> node_traits;
+
+    // declared before reclaim_, which frees the last retired nodes
+    // through it when it goes.
+    node_alloc_t alloc_;
+
+    // consumers read tail_->next_ while another consumer may be retiring
+    // tail_, so retired nodes are deleted only once no consumer can still
+    // reach them.
+    reclaim_t reclaim_;
+
+    node* new_node(T const& value)
+    {
+        node* n = node_traits::allocate(alloc_, 1);
+        node_traits::construct(alloc_, n, value);
+        set_owner(n, stateless_tag());
+        return n;
+    }
+
+    void set_owner(node*, std::true_type) {}
+
+    void set_owner(node* n, std::false_type)
+    {
+        n->queue_ = this;
+    }
+
+    static void delete_node(node_alloc_t& a, node* n)
+    {
+        node_traits::destroy(a, n);
+        node_traits::deallocate(a, n, 1);
+    }
+
+    static void release_node(node* n, std::true_type)
+    {
+        node_alloc_t a;
+        delete_node(a, n);
+    }
+
+    static void release_node(node* n, std::false_type)
+    {
+        delete_node(n->queue_->alloc_, n);
+    }
+
+    static void free_node(defer_node* n)
+    {
+        release_node(static_cast<node*>(n), stateless_tag());
+    }
+
+    bool take(T& value, typename reclaim_t::guard& g)
+    {
+        node* n;
+        node* t = g.protect(0, tail_); // synchronize with producers
+        for (;;) {
+            n = t->next_.load(std::memory_order_acquire); // synchronize with consumer and other producer
+            if (!n) {
+                return false;
+            }
+            // n is only safe while t is still the tail, check after
+            // publishing it.
+            g.publish(1, n);
+            if (tail_.load(std::memory_order_acquire) != t) {
+                t = g.protect(0, tail_);
+                continue;
+            }
+            value = n->value_;
+            if (tail_.compare_exchange_weak(t, n, std::memory_order_acq_rel)) {
+                break;
+            }
+            t = g.protect(0, tail_);
+        }
+
+        // n stays published until the guard goes, so its next_ can be
+        // read here.
+        if (T_prefetch) {
+            prefetch_node(n->next_.load(std::memory_order_relaxed));
+        }
+
+        // other consumers may still use t, free it once they can't reach
+        // it any more. producers never touch t again: the one that linked
+        // n was the last to write t->next_.
+        g.retire(t, &mpmc_queue::free_node);
+        return true;
+    }
+
+public:
+    typedef node node_type;
+
+    explicit mpmc_queue(alloc_t const& alloc = alloc_t())
+        : enqueued_(0), closed_count_(open_), dequeued_(0), alloc_(alloc)
+    {
+        node* stub = new_node(T());
+        head_.store(stub, std::memory_order_relaxed);
+        tail_.store(stub, std::memory_order_relaxed);
+    }
+
+
+    ~mpmc_queue()
+    {
+        assert(head_.load(std::memory_order_relaxed) ==
+                            tail_.load(std::memory_order_relaxed));
+        // retired nodes belong to reclaim_ and go with it, what is still
+        // linked is only the current stub.
+        node* n = tail_.load(std::memory_order_relaxed);
+        while (n) {
+            node* next = n->next_.load(std::memory_order_relaxed);
+            delete_node(alloc_, n);
+            n = next;
+        }
+    }
+
+
+public:
+    bool enqueue(T const& value)
+    {
+        // reserve first, so close() knows how many elements it has to
+        // wait for.
+        if (enqueued_.fetch_add(1, std::memory_order_acq_rel) & closed_bit_) {
+            enqueued_.fetch_sub(1, std::memory_order_relaxed);
+            return false;
+        }
+        node* n = new_node(value);
+        node* p = head_.exchange(n, std::memory_order_acq_rel); // serialize producers
+        /* if this thread dies, this will be the dangerous zone */
+        p->next_.store(n, std::memory_order_release); // serialize consumer
+        // head<-nodeN<-..node1<-tail
+        return true;
+    }
+
+
+    bool dequeue(T& value)
+    {
+        typename reclaim_t::guard g(reclaim_);
+        if (!take(value, g)) {
+            return false;
+        }
+        dequeued_.fetch_add(1, std::memory_order_release);
+        return true;
+    }
+
+    // dequeue up to `max' elements into `values' under one guard, returns
+    // how many. stops at the first failed dequeue.
+    size_t dequeue_bulk(T* values, size_t max)
+    {
+        typename reclaim_t::guard g(reclaim_);
+        size_t count = 0;
+        while (count != max && take(values[count], g)) {
+            ++count;
+        }
+        if (count) {
+            dequeued_.fetch_add(count, std::memory_order_release);
+        }
+        return count;
+    }
+
+    // wait-free depth hint; a consumer may count before the producer of
+    // the same element did, so clamp at zero.
+    size_t size_approx() const
+    {
+        size_t deq = dequeued_.load(std::memory_order_relaxed);
+        size_t enq = enqueued_.load(std::memory_order_relaxed) & ~closed_bit_;
+        return enq > deq ? enq - deq : 0;
+    }
+
+    bool empty() const
+    {
+        return size_approx() == 0;
+    }
+
+    // O(1) shutdown: enqueues fail from now on, dequeues keep draining
+    // what was enqueued before.
+    void close()
+    {
+        size_t enq = enqueued_.fetch_or(closed_bit_, std::memory_order_acq_rel);
+        if (!(enq & closed_bit_)) {
+            // the count has to be kept: producers turned away from now on
+            // still bump enqueued_ for a moment.
+            closed_count_.store(enq, std::memory_order_release);
+        }
+    }
+
+    bool is_closed() const
+    {
+        return (enqueued_.load(std::memory_order_acquire) & closed_bit_) != 0;
+    }
+
+    // true once the queue is closed and every element reserved before
+    // the close has been dequeued. it stays true, so a consumer whose
+    // dequeue failed can stop when it sees this.
+    bool closed() const
+    {
+        size_t enq = closed_count_.load(std::memory_order_acquire);
+        if (enq == open_) {
+            return false;
+        }
+        return dequeued_.load(std::memory_order_acquire) >= enq;
+    }
+};
+
+#endif /* end of MPMC_QUEUE_H */
@@ -2,73 +2,15 @@
 #include <atomic>
 #include <cassert>
 #include <memory>
+#include <functional>
 #include <thread>
 #include <iostream>
 
 #include "eventcount.h"
-#include "proxy_collector.h"
+#include "mpmc_queue.h"
 
 #include <emmintrin.h>
 
-template<typename T>
-class mpmc_queue {
-    struct node {
-        std::atomic<node*> next_;
-        T volatile value_;
-        node(T value, node *next = nullptr) : value_(value)
-        {
-            next_.store(next, std::memory_order_relaxed);
-        }
-    };
-
-    std::unique_ptr<node> stub_;
-    std::atomic<node*> head_;
-    std::atomic<node*> tail_;
-
-public:
-    mpmc_queue() : stub_(new node(0))
-    {
-        head_.store(stub_.get(), std::memory_order_relaxed);
-        tail_.store(stub_.get(), std::memory_order_relaxed);
-    }
-
-
-    ~mpmc_queue()
-    {
-        assert(head_.load(std::memory_order_relaxed) ==
-                            tail_.load(std::memory_order_relaxed));
-    }
-
-
-public:
-    void enqueue(T& value)
-    {
-        node* n = new node(value);
-        node* p = head_.exchange(n, std::memory_order_acq_rel); // serialize producers
-        /* if this thread dies, this will be the dangerous zone */
-        p->next_.store(n, std::memory_order_release); // serialize consumer
-        // head<-nodeN<-..node1<-tail
-    }
-
-
-    bool dequeue(T& value)
-    {
-        node* n;
-        node* t = tail_.load(std::memory_order_acq_rel); // synchronize with producers
-        do {
-            n = t->next_.load(std::memory_order_acq_rel); // synchronize with consumer and other producer
-            if (!n) {
-                return false;
-            } else {
-                value = n->value_;
-            }
-        } while (!tail_.compare_exchange_weak(t, n, std::memory_order_acq_rel));
-        // can't free t here, other consumer may still use the node
-        return true;
-    }
-};
-
-
 #define PRODUCERS 4
 #define CONSUMERS 4
 #define THREADS (PRODUCERS + CONSUMERS)
@@ -76,7 +18,8 @@ public:
 
 eventcount ec;
 mpmc_queue<int> queue;
-std::atomic<int> count;
+std::atomic<int> producers{PRODUCERS};
+std::atomic<int> consumed{0};
 static std::atomic<bool> volatile g_start{0};
 
 static void thread_func(unsigned tidx) {
@@ -100,24 +43,20 @@ static void thread_func(unsigned tidx) {
             queue.enqueue(i);
             ec.notify();
         }
+        // last producer out shuts the queue down, which wakes every
+        // parked consumer at once.
+        if (producers.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+            queue.close();
+            ec.close();
+        }
     } else {
-        do {
-            while (!queue.dequeue(i)) {
-                ec.prepare_wait();
-                if (queue.dequeue(i)) {
-                    ec.cancel_wait();
-                    break;
-                }
-                ec.commit_wait();
-            }
-        } while (i != -666 && count.fetch_add(-1, std::memory_order_relaxed) !=  1);
-        if (i != -666) {
-            for (i = 1; i < CONSUMERS; ++i) {
-                int x = -666;
-                queue.enqueue(x);
+        for (;;) {
+            if (ec.await([&]{ return queue.dequeue(i); })) {
+                consumed.fetch_add(1, std::memory_order_relaxed);
+            } else if (queue.closed()) {
+                break;
             }
-            ec.notify();
-        } 
+        }
     }
 }
 
@@ -154,5 +93,7 @@ int main()
         << time / (ITERS * THREADS)
         << std::endl;
 
+    assert(consumed == PRODUCERS * ITERS);
+
     return 0;
 }
@@ -0,0 +1,84 @@
+/*
+ * read-side cost of the proxy collector in proxy_collector.h: every thread
+ * does acquire()/release() pairs back to back while one more thread keeps
+ * retiring nodes, so collectors are swung in underneath the readers.
+ * prints cycles per acquire/release pair for a growing number of readers.
+ */
+
+#include <atomic>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+#include "proxy_collector.h"
+
+#define PAIRS 1000000
+#define MAX_READERS 32
+
+static std::atomic<bool> g_start{false};
+static std::atomic<size_t> g_running{0};
+
+static inline uint64_t rdtsc() {
+    uint64_t lo, hi;
+    __asm__ volatile ("rdtsc"
+            : "=a" (lo), "=d"(hi) /*outputs */
+            : /* no input parameters */
+            : "%ebx", "%ecx", "memory"); /* clobbers */
+    return lo | (hi << 32);
+}
+
+static void free_node(defer_node* n) {
+    delete n;
+}
+
+static void reader(proxy& p, size_t pairs) {
+    while (!g_start.load(std::memory_order_relaxed)) {
+        std::this_thread::yield();
+    }
+    for (size_t i = 0; i != pairs; ++i) {
+        proxy::collector* c = p.acquire();
+        p.release(c);
+    }
+    g_running.fetch_sub(1, std::memory_order_relaxed);
+}
+
+static void retirer(proxy& p) {
+    while (g_running.load(std::memory_order_relaxed)) {
+        p.defer_recycle(new defer_node, &free_node);
+        std::this_thread::yield();
+    }
+}
+
+// per pair on one core: elapsed time is scaled by the cores that were busy.
+static uint64_t run(size_t readers) {
+    proxy p;
+    size_t pairs = PAIRS / readers;
+    g_start = false;
+    g_running = readers;
+
+    std::thread r(retirer, std::ref(p));
+    std::vector<std::thread> threads;
+    for (size_t i = 0; i != readers; ++i) {
+        threads.push_back(std::thread(reader, std::ref(p), pairs));
+    }
+
+    uint64_t start = rdtsc();
+    g_start = true;
+    for (size_t i = 0; i != readers; ++i) {
+        threads[i].join();
+    }
+    uint64_t end = rdtsc();
+    r.join();
+
+    size_t cores = std::thread::hardware_concurrency();
+    size_t busy = (cores && cores < readers) ? cores : readers;
+    return (end - start) * busy / (pairs * readers);
+}
+
+int main() {
+    for (size_t readers = 1; readers <= MAX_READERS; readers *= 2) {
+        std::cout << "readers=" << readers
+            << " acquire/release cycles/op=" << run(readers) << std::endl;
+    }
+    return 0;
+}
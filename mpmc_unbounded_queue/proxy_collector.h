@@ -5,65 +5,229 @@
 #include <cassert>
 #include <array>
 #include <atomic>
+#include <chrono>
 #include <thread>
 #include <iostream>
 
+#include "../common/defer_node.h"
+#include "../common/thread_records.h"
+
+/*
+ * retired objects are intrusive: they carry a defer_node hook with the
+ * link and a plain function pointer that frees them. defer_recycle() pushes
+ * the hook on the current tail collector, so retiring costs a tail load, a
+ * push and a counter bump; a new collector is only swung in once every
+ * `batch' retirements (or on flush()), and everything on a collector is
+ * freed together when that collector dies.
+ *
+ * retire() goes one step further and first gathers objects in a batch per
+ * thread, which is spliced onto the tail collector in one go once it holds
+ * `local_batch' objects or its oldest object has waited `max_age'. batches
+ * of exiting threads are spliced when the thread goes; flush_retired()
+ * hands over the calling thread's batch right away, e.g. at shutdown.
+ *
+ * tail_, free_head_ and free_tail_ pair a sequence with a 32-bit collector
+ * index instead of a pointer, so they fit one 64-bit word and are updated
+ * with ordinary atomics; no DWCAS, no libatomic lock fallback. readers
+ * enter with one fetch_add on tail_.
+ */
 class proxy
 {
 public:
-    typedef int sequence_type;
+    typedef uint32_t sequence_type; // differential counts, wrap around
+    typedef uint32_t index_type;
+    static const index_type nil = ~(index_type)0;
     struct collector;
+
+    typedef ::defer_node defer_node;
+    class guard;
     
+    // the sequence and the collector's index in the table below, packed in
+    // one word so every update is a plain 64-bit atomic. the sequence sits
+    // in the high half: acquire() bumps it with a fetch_add, and when it
+    // wraps the carry falls off the top instead of into the index.
     struct sequence_collector
     {
         sequence_type sequence_;
-        collector* c_;
+        index_type index_;
+        
+        sequence_collector(index_type index = nil, sequence_type sequence = 0) : sequence_(sequence), index_(index) { }
+        explicit sequence_collector(uint64_t word) : sequence_((sequence_type)(word >> 32)), index_((index_type)word) { }
         
-        sequence_collector(collector* c = nullptr, sequence_type sequence = 0) : c_(c), sequence_(sequence) { }
+        uint64_t word() const
+        {
+            return ((uint64_t)sequence_ << 32) | index_;
+        }
     };
     
+#if __cplusplus >= 201703L
+    static_assert(std::atomic<uint64_t>::is_always_lock_free,
+        "sequence_collector must be a lock-free word");
+#else
+    static_assert(ATOMIC_LLONG_LOCK_FREE == 2,
+        "sequence_collector must be a lock-free word");
+#endif
+    
     struct collector
     {
         std::atomic<sequence_type> count_;
-        std::atomic<sequence_collector> next_;
-        std::function<void()> defer_free;
+        std::atomic<index_type> next_;
+        std::atomic<defer_node*> defer_;
+        std::atomic<unsigned> defer_count_;
+        index_type index_;
         
-        collector(sequence_type count = 0) : count_(count), next_(sequence_collector()), defer_free(nullptr) { }
+        collector() : count_(0), next_(nil), defer_(nullptr), defer_count_(0), index_(nil) { }
         void reset()
         {
             count_ = 0;
-            next_.store(sequence_collector(), std::memory_order_relaxed);
-            defer_free = nullptr;
+            next_.store(nil, std::memory_order_relaxed);
+            defer_.store(nullptr, std::memory_order_relaxed);
+            defer_count_.store(0, std::memory_order_relaxed);
         }
         ~collector() { }
     };
     
 private:
+    typedef std::chrono::steady_clock clock;
+    
+    // objects retired by one thread and not handed to a collector yet.
+    struct retire_batch
+    {
+        std::atomic<bool> active_;
+        retire_batch* next_;
+        proxy* owner_;
+        defer_node* first_;
+        defer_node* last_;
+        unsigned count_;
+        clock::time_point since_;
+        
+        retire_batch() : next_(nullptr), owner_(nullptr), first_(nullptr), last_(nullptr), count_(0) { }
+        
+        // the thread is going away, don't leave its objects behind.
+        void release()
+        {
+            if (first_) {
+                owner_->attach(*this);
+            }
+        }
+    };
+    
     static const sequence_type GUARD = 1;
     static const sequence_type REFERENCE = 2;
-    std::atomic<sequence_collector> tail_; // link other collectors
-    std::atomic<sequence_collector> free_head_;
-    std::atomic<sequence_collector> free_tail_;
+    
+    // collectors are never freed before the proxy, so they live in a table
+    // of chunks that are allocated on demand and addressed by index. when
+    // the table is full (a reader stalled long enough to keep max_collectors
+    // alive) flush() leaves the tail in place and it goes on collecting.
+    static const unsigned chunk_shift = 6;
+    static const index_type chunk_size = 1U << chunk_shift;
+    static const unsigned max_chunks = 1024;
+    static const index_type max_collectors = max_chunks * chunk_size;
+    
+    std::atomic<uint64_t> tail_; // link other collectors
+    std::atomic<uint64_t> free_head_;
+    std::atomic<uint64_t> free_tail_;
+    unsigned const batch_;
+    unsigned const local_batch_;
+    clock::duration const max_age_;
+    std::atomic<index_type> collector_count_;
+    std::atomic<collector*> chunks_[max_chunks];
+    thread_records<retire_batch> batches_;
+    
+    static void destroy(defer_node* n)
+    {
+        while (n) {
+            defer_node* next = n->defer_next_;
+            n->defer_free_(n);
+            n = next;
+        }
+    }
+    
+    collector* at(index_type index) const
+    {
+        return &chunks_[index >> chunk_shift].load(std::memory_order_acquire)[index & (chunk_size - 1)];
+    }
+    
+    // nullptr once the table is full.
+    collector* new_collector()
+    {
+        index_type index = collector_count_.load(std::memory_order_relaxed);
+        do {
+            if (index == max_collectors) {
+                return nullptr;
+            }
+        } while (!collector_count_.compare_exchange_weak(index, index + 1, std::memory_order_relaxed));
+        unsigned chunk = index >> chunk_shift;
+        
+        collector* cs = chunks_[chunk].load(std::memory_order_acquire);
+        if (cs == nullptr) {
+            collector* fresh = new collector[chunk_size];
+            if (chunks_[chunk].compare_exchange_strong(cs, fresh, std::memory_order_acq_rel, std::memory_order_acquire)) {
+                cs = fresh;
+            } else {
+                delete [] fresh;
+            }
+        }
+        
+        collector* c = &cs[index & (chunk_size - 1)];
+        c->index_ = index;
+        return c;
+    }
+    
+    // link `first'..`last' onto the tail collector; the caller holds a
+    // collector, so the tail can't die underneath us.
+    void splice(defer_node* first, defer_node* last, unsigned count)
+    {
+        // order the caller's unlink before we pick the collector, readers
+        // that acquire a later collector must not find the objects any more.
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        collector* tail = at(sequence_collector(tail_.load(std::memory_order_acquire)).index_);
+        
+        defer_node* head = tail->defer_.load(std::memory_order_relaxed);
+        do {
+            last->defer_next_ = head;
+        } while (!tail->defer_.compare_exchange_weak(head, first, std::memory_order_release, std::memory_order_relaxed));
+        
+        // every `batch' objects, not just the first time: a flush that
+        // found no collector is tried again once the tail has grown.
+        unsigned before = tail->defer_count_.fetch_add(count, std::memory_order_relaxed);
+        if (before / batch_ != (before + count) / batch_) {
+            flush();
+        }
+    }
+    
+    void attach(retire_batch& b)
+    {
+        collector* c = acquire();
+        splice(b.first_, b.last_, b.count_);
+        release(c);
+        b.first_ = b.last_ = nullptr;
+        b.count_ = 0;
+    }
     
     collector* alloc_collector(bool alloc)
     {
         collector *c = nullptr;
         sequence_collector old_free, new_free;
         
-        old_free = free_head_.load(std::memory_order_acquire);
-        while (old_free.c_ != free_tail_.load(std::memory_order_relaxed).c_) {
-            new_free.c_ = old_free.c_->next_.load(std::memory_order_relaxed).c_;
+        uint64_t word = free_head_.load(std::memory_order_acquire);
+        for (;;) {
+            old_free = sequence_collector(word);
+            if (old_free.index_ == sequence_collector(free_tail_.load(std::memory_order_relaxed)).index_) {
+                break;
+            }
+            new_free.index_ = at(old_free.index_)->next_.load(std::memory_order_relaxed);
             new_free.sequence_ = old_free.sequence_ + GUARD;
             
-            if (free_head_.compare_exchange_strong(old_free, new_free, std::memory_order_acq_rel, std::memory_order_acquire)) {
-                c = old_free.c_;
+            if (free_head_.compare_exchange_strong(word, new_free.word(), std::memory_order_acq_rel, std::memory_order_acquire)) {
+                c = at(old_free.index_);
                 c->reset();
                 break;
             }
         }
                
         if (c == nullptr && alloc) {
-            c = new collector();
+            c = new_collector();
         }
         
         return c;
@@ -72,9 +236,9 @@ private:
     void release_adjust(collector* c, sequence_type adjust)
     {
         collector* current;
-        collector* next;
+        index_type next;
         
-        sequence_collector free_tail, free_tail_next;
+        uint64_t free_tail;
         
         // only GUARD bit cleared can do the deferred free
         sequence_type adjusted_count = REFERENCE - adjust;
@@ -86,31 +250,38 @@ private:
                // clear the GUARD protection and transfer the external to internal
                || current->count_.fetch_sub(adjusted_count, std::memory_order_acq_rel) == adjusted_count) {
             
-            next = current->next_.load(std::memory_order_relaxed).c_;
+            next = current->next_.load(std::memory_order_relaxed);
             
-            free_tail = free_tail_.load(std::memory_order_consume);
-            do {
-                free_tail_next = free_tail.c_->next_.load(std::memory_order_relaxed);
-            } while (!free_tail_.compare_exchange_weak(free_tail, free_tail_next, std::memory_order_acq_rel, std::memory_order_acquire));
+            // take the objects retired while `current' was the tail before
+            // it goes back to the free list.
+            defer_node* defer = current->defer_.exchange(nullptr, std::memory_order_acquire);
             
-            current = next;
+            free_tail = free_tail_.load(std::memory_order_acquire);
+            while (!free_tail_.compare_exchange_weak(free_tail,
+                    sequence_collector(at(sequence_collector(free_tail).index_)->next_.load(std::memory_order_relaxed)).word(),
+                    std::memory_order_acq_rel, std::memory_order_acquire));
             
-            // free data queued for deferred deletion (in the next node)
-            if (current->defer_free) {
-                current->defer_free();
-                current->defer_free = nullptr;
-            }
+            destroy(defer);
             
+            current = at(next);
             adjusted_count = REFERENCE;
         }
     }
 
     
 public:
-    proxy()
+    explicit proxy(unsigned batch = 64, unsigned local_batch = 32,
+                   clock::duration max_age = std::chrono::milliseconds(1))
+        : batch_(batch ? batch : 1), local_batch_(local_batch ? local_batch : 1)
+        , max_age_(max_age), collector_count_(0)
     {
-        collector *c = new collector(GUARD + REFERENCE);
-        sequence_collector sc(c, 0);
+        for (unsigned i = 0; i != max_chunks; ++i) {
+            chunks_[i].store(nullptr, std::memory_order_relaxed);
+        }
+        
+        collector *c = new_collector();
+        c->count_ = GUARD + REFERENCE;
+        uint64_t sc = sequence_collector(c->index_, 0).word();
         
         free_tail_.store(sc, std::memory_order_relaxed);
         tail_.store(sc, std::memory_order_relaxed);
@@ -119,28 +290,27 @@ public:
     
     ~proxy()
     {
-        collector* current;
-        collector* next;
-        
-        current = free_head_.load(std::memory_order_relaxed).c_;
-        while (current) {
-            next = current->next_.load(std::memory_order_relaxed).c_;
-            delete current;
-            current = next;
+        // no readers left, whatever is still deferred can go.
+        for (retire_batch* b = batches_.head(); b; b = b->next_) {
+            destroy(b->first_);
+            b->first_ = nullptr;
+        }
+        index_type count = collector_count_.load(std::memory_order_relaxed);
+        for (index_type i = 0; i != count; ++i) {
+            destroy(at(i)->defer_.load(std::memory_order_relaxed));
+        }
+        for (unsigned i = 0; i != max_chunks; ++i) {
+            delete [] chunks_[i].load(std::memory_order_relaxed);
         }
     }
 
+    // a single fetch_add takes the reference and reads the collector, so
+    // entering is wait-free however many readers there are.
     collector* acquire()
     {
-        sequence_collector old_tail, new_tail;
-        
-        old_tail = tail_.load(std::memory_order_relaxed);
-        do {
-            new_tail.sequence_ = old_tail.sequence_ + REFERENCE;
-            new_tail.c_ = old_tail.c_;
-        } while (!tail_.compare_exchange_weak(old_tail, new_tail, std::memory_order_relaxed, std::memory_order_relaxed));
+        uint64_t old_tail = tail_.fetch_add((uint64_t)REFERENCE << 32, std::memory_order_acquire);
         
-        return old_tail.c_;
+        return at(sequence_collector(old_tail).index_);
     }
 
     void release(collector* c)
@@ -148,30 +318,118 @@ public:
         release_adjust(c, 0);
     }
 
-    template<class F, class... Args>
-    void defer_recycle(F&& f, Args&&... args)
+    // retire `n' while holding `c'. it goes on the current tail, which
+    // can't die before `c' does since collectors die in list order.
+    void defer_recycle(collector* /* held */, defer_node* n, void (*free_fn)(defer_node*))
     {
-        collector *c;
-        sequence_collector old_tail, new_tail;
-        // link the node to current collector
+        n->defer_free_ = free_fn;
+        splice(n, n, 1);
+    }
+    
+    // same, for callers outside a region.
+    void defer_recycle(defer_node* n, void (*free_fn)(defer_node*))
+    {
+        collector* c = acquire();
+        defer_recycle(c, n, free_fn);
+        release(c);
+    }
+    
+    // retire `n' into the calling thread's batch, no region needed. it
+    // touches no shared state until the batch is full or too old; the age
+    // is only checked in here, a batch doesn't go anywhere between calls.
+    void retire(defer_node* n, void (*free_fn)(defer_node*))
+    {
+        bool owned;
+        retire_batch* b = batches_.local(owned);
+        b->owner_ = this;
         
-        while ((c = alloc_collector(true)) == nullptr) {
-            std::this_thread::yield();
+        n->defer_free_ = free_fn;
+        n->defer_next_ = b->first_;
+        if (!b->first_) {
+            b->last_ = n;
+            b->since_ = clock::now();
+        }
+        b->first_ = n;
+        
+        // reading the clock costs more than the rest of retire(), so the
+        // age is only looked at on the 1st, 2nd, 4th, 8th.. and every 64th
+        // one.
+        unsigned count = ++b->count_;
+        bool check_age = (count & (count - 1)) == 0 || (count & 63) == 0;
+        if (count >= local_batch_ || owned || (check_age && clock::now() - b->since_ >= max_age_)) {
+            attach(*b);
+        }
+        if (owned) {
+            batches_.release(b);
+        }
+    }
+    
+    // hand the calling thread's batch to a collector and close that
+    // collector, so everything retired so far goes as soon as the readers
+    // that may still see it are gone.
+    void flush_retired()
+    {
+        bool owned;
+        retire_batch* b = batches_.local(owned);
+        if (b->first_) {
+            attach(*b);
+        }
+        if (owned) {
+            batches_.release(b);
+        }
+        flush();
+    }
+    
+    // close the current batch: swing in a new tail collector, so the old
+    // one dies, and frees its objects, as soon as its readers are gone. if
+    // every collector is still held the batch stays open instead.
+    void flush()
+    {
+        collector *c = alloc_collector(true);
+        if (c == nullptr) {
+            return;
         }
         
         c->count_ = GUARD + 2 * REFERENCE;
-        c->defer_free = std::bind(std::forward<F>(f), std::forward<Args>(args)...);
         
         /* monkey through the trees queuing trick */
-        new_tail.c_ = c;
-        new_tail.sequence_ = 0;
-        
-        old_tail = tail_.load(std::memory_order_consume);
-        while (!tail_.compare_exchange_weak(old_tail, new_tail, std::memory_order_acq_rel, std::memory_order_acquire));
+        sequence_collector old_tail(tail_.exchange(sequence_collector(c->index_, 0).word(), std::memory_order_acq_rel));
         
-        old_tail.c_->next_.store(c, std::memory_order_relaxed);
+        collector* old = at(old_tail.index_);
+        old->next_.store(c->index_, std::memory_order_relaxed);
         
-        release_adjust(old_tail.c_, (old_tail.sequence_ - GUARD));
+        release_adjust(old, (old_tail.sequence_ - GUARD));
+    }
+};
+
+
+// scoped region with the interface shared by the reclamation schemes
+// (see hazard_pointer/hazard_pointer.h). a region protects everything,
+// so protect() is just a load and publish() has nothing to do.
+class proxy::guard
+{
+    proxy& proxy_;
+    collector* c_;
+
+public:
+    explicit guard(proxy& p) : proxy_(p), c_(p.acquire()) {}
+    ~guard() { proxy_.release(c_); }
+
+    guard(guard const&) = delete;
+    void operator = (guard const&) = delete;
+
+    template<typename N>
+    N* protect(unsigned, std::atomic<N*> const& src)
+    {
+        return src.load(std::memory_order_acquire);
+    }
+
+    template<typename N>
+    void publish(unsigned, N*) {}
+
+    void retire(defer_node* n, void (*free_fn)(defer_node*))
+    {
+        proxy_.defer_recycle(c_, n, free_fn);
     }
 };
 
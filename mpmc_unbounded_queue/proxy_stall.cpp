@@ -0,0 +1,46 @@
+/*
+ * a reader that stalls inside its region while another thread keeps
+ * retiring with batch 1, so every retirement tries to swing in a new
+ * collector. the stall keeps them all alive, the table runs full well
+ * before the end, and the proxy has to keep collecting on the tail. once
+ * the reader leaves, a flush must free every retired node.
+ */
+
+#include <atomic>
+#include <cstdlib>
+#include <iostream>
+
+#include "proxy_collector.h"
+
+#define RETIRED 200000 // several times the number of collectors
+
+static std::atomic<long> g_freed{0};
+
+static void free_node(defer_node* n) {
+    g_freed.fetch_add(1, std::memory_order_relaxed);
+    delete n;
+}
+
+int main() {
+    proxy p(1);
+    proxy::collector* stalled = p.acquire();
+
+    for (long i = 0; i != RETIRED; ++i) {
+        p.defer_recycle(new defer_node, &free_node);
+    }
+    long early = g_freed.load();
+
+    p.release(stalled);
+    p.flush();
+    long freed = g_freed.load();
+
+    std::cout << "retired=" << RETIRED
+        << " freed while stalled=" << early
+        << " freed after release=" << freed << std::endl;
+    if (early != 0 || freed != RETIRED) {
+        std::cout << "FAILED" << std::endl;
+        return EXIT_FAILURE;
+    }
+    std::cout << "ok" << std::endl;
+    return 0;
+}
@@ -0,0 +1,89 @@
+/*
+ * per-node retirement cost of the proxy collector in proxy_collector.h as
+ * a function of the thread-local batch size. retirers hand pre-allocated
+ * nodes to retire(), one reader keeps entering and leaving regions. the
+ * cost includes freeing the nodes once their collector dies. the first
+ * row is defer_recycle(), which splices every node on its own.
+ */
+
+#include <atomic>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+#include "proxy_collector.h"
+
+#define RETIRERS 2
+#define NODES 1000000
+
+static std::atomic<bool> g_start{false};
+static std::atomic<size_t> g_running{0};
+
+static inline uint64_t rdtsc() {
+    uint64_t lo, hi;
+    __asm__ volatile ("rdtsc"
+            : "=a" (lo), "=d"(hi) /*outputs */
+            : /* no input parameters */
+            : "%ebx", "%ecx", "memory"); /* clobbers */
+    return lo | (hi << 32);
+}
+
+static void free_node(defer_node* n) {
+    delete n;
+}
+
+static void retirer(proxy& p, bool batched) {
+    std::vector<defer_node*> nodes(NODES / RETIRERS);
+    for (size_t i = 0; i != nodes.size(); ++i) {
+        nodes[i] = new defer_node;
+    }
+    while (!g_start.load(std::memory_order_relaxed)) {
+        std::this_thread::yield();
+    }
+    for (size_t i = 0; i != nodes.size(); ++i) {
+        if (batched) {
+            p.retire(nodes[i], &free_node);
+        } else {
+            p.defer_recycle(nodes[i], &free_node);
+        }
+    }
+    p.flush_retired();
+    g_running.fetch_sub(1, std::memory_order_relaxed);
+}
+
+static void reader(proxy& p) {
+    while (g_running.load(std::memory_order_relaxed)) {
+        proxy::collector* c = p.acquire();
+        p.release(c);
+    }
+}
+
+static uint64_t run(unsigned local_batch, bool batched) {
+    proxy p(64, local_batch, std::chrono::seconds(1));
+    g_start = false;
+    g_running = RETIRERS;
+
+    std::vector<std::thread> threads;
+    for (size_t i = 0; i != RETIRERS; ++i) {
+        threads.push_back(std::thread(retirer, std::ref(p), batched));
+    }
+    std::thread r(reader, std::ref(p));
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+    uint64_t start = rdtsc();
+    g_start = true;
+    for (size_t i = 0; i != RETIRERS; ++i) {
+        threads[i].join();
+    }
+    uint64_t end = rdtsc();
+    r.join();
+    return (end - start) / NODES;
+}
+
+int main() {
+    std::cout << "defer_recycle cycles/node=" << run(1, false) << std::endl;
+    for (unsigned batch = 1; batch <= 1024; batch *= 4) {
+        std::cout << "retire batch=" << batch << " cycles/node=" << run(batch, true) << std::endl;
+    }
+    return 0;
+}
@@ -0,0 +1,90 @@
+/*
+ * sustained load on mpmc_queue while sampling the resident set size.
+ * producers and consumers run flat out for `DURATION' seconds; the queue
+ * depth stays small, so with working reclamation RSS levels off after the
+ * first samples instead of growing with the number of messages.
+ */
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <thread>
+#include <iostream>
+#include <unistd.h>
+
+#include "mpmc_queue.h"
+
+#define PRODUCERS 2
+#define CONSUMERS 2
+#define THREADS (PRODUCERS + CONSUMERS)
+#define DURATION 10
+#define SAMPLE_MS 500
+
+mpmc_queue<long> queue;
+static std::atomic<bool> g_stop{false};
+static std::atomic<long> g_consumed{0};
+
+// resident set size in KiB, 0 where /proc is not available.
+static long rss_kb() {
+    long pages = 0, resident = 0;
+    FILE* f = fopen("/proc/self/statm", "r");
+    if (!f) {
+        return 0;
+    }
+    if (fscanf(f, "%ld %ld", &pages, &resident) != 2) {
+        resident = 0;
+    }
+    fclose(f);
+    return resident * (sysconf(_SC_PAGESIZE) / 1024);
+}
+
+static void thread_func(unsigned tidx) {
+    long i = 0;
+    if (tidx < PRODUCERS) {
+        while (!g_stop.load(std::memory_order_relaxed)) {
+            // keep the queue shallow, we measure leaks, not backlog.
+            if (queue.size_approx() < 1024) {
+                queue.enqueue(i++);
+            } else {
+                std::this_thread::yield();
+            }
+        }
+    } else {
+        long consumed = 0;
+        while (!g_stop.load(std::memory_order_relaxed)) {
+            if (queue.dequeue(i)) {
+                consumed += 1;
+            } else {
+                std::this_thread::yield();
+            }
+        }
+        while (queue.dequeue(i)) {
+            consumed += 1;
+        }
+        g_consumed.fetch_add(consumed, std::memory_order_relaxed);
+    }
+}
+
+int main()
+{
+    std::array<std::thread, THREADS> threads;
+    for (size_t i = 0; i != THREADS; ++i) {
+        threads[i] = std::thread(thread_func, i);
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    for (int ms = 0; ms <= DURATION * 1000; ms += SAMPLE_MS) {
+        std::this_thread::sleep_until(start + std::chrono::milliseconds(ms));
+        std::cout << "t=" << ms << "ms rss=" << rss_kb() << "KiB"
+            << " depth~" << queue.size_approx() << std::endl;
+    }
+
+    g_stop = true;
+    for (size_t i = 0; i != THREADS; ++i) {
+        threads[i].join();
+    }
+
+    std::cout << "messages=" << g_consumed.load() << std::endl;
+    return 0;
+}
@@ -2,115 +2,178 @@
 #define EVENCOUNT_H
 
 #include <atomic>
+#include <cstdint>
 #include <semaphore.h>
 
+/*
+ * usage:
+ *     key = prepare_wait();
+ *     if (condition) cancel_wait(); else commit_wait(key);
+ *
+ * close() is for shutdown: it wakes every parked waiter at once and makes
+ * every later commit_wait() return immediately, so consumers fall through
+ * to draining their queue instead of being sent one poison pill each.
+ */
 #ifdef __APPLE__
 class eventcount {
 public:
-    
-    eventcount() :  waiting(false) {
+    typedef uint32_t key_type;
+
+    eventcount() :  waiters(0), closed_(false) {
         semaphore = sem_open("eventcount", O_CREAT, 0600, 0);
     }
-    
+
     ~eventcount() {
         sem_close(semaphore);
     }
-    
-    void prepare_wait() {
-        waiting.store(true, std::memory_order_seq_cst);
+
+    key_type prepare_wait() {
+        waiters.fetch_add(1, std::memory_order_seq_cst);
+        return 0;
     }
-    
+
     void cancel_wait() {
-        waiting.store(false, std::memory_order_release);
+        waiters.fetch_sub(1, std::memory_order_release);
     }
-    
-    void commit_wait() {
-        sem_wait(semaphore);
+
+    void commit_wait(key_type) {
+        if (!closed_.load(std::memory_order_acquire)) {
+            sem_wait(semaphore);
+        }
+        waiters.fetch_sub(1, std::memory_order_release);
     }
-    
+
     void notify() {
-        if (waiting.load(std::memory_order_acquire)) {
-            waiting.store(false, std::memory_order_release);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (waiters.load(std::memory_order_relaxed)) {
+            sem_post(semaphore);
+        }
+    }
+
+    // no broadcast on a plain semaphore, so this posts once per waiter.
+    void close() {
+        closed_.store(true, std::memory_order_seq_cst);
+        for (unsigned n = waiters.load(std::memory_order_seq_cst); n; --n) {
             sem_post(semaphore);
         }
     }
-    
+
+    bool closed() const {
+        return closed_.load(std::memory_order_acquire);
+    }
+
     template<typename FUNC>
     auto await(FUNC func) -> decltype(func()) {
         decltype(func()) result = func();
-        while (!result) {
-            prepare_wait();
+        while (!result && !closed()) {
+            key_type key = prepare_wait();
             result = func();
-            if (result) {
+            if (result || closed()) {
                 cancel_wait();
                 break;
             }
-            commit_wait();
+            commit_wait(key);
             result = func();
         }
         return result;
     }
-    
-    
+
+
 private:
-    
-    std::atomic<bool> waiting;
+
+    std::atomic<unsigned> waiters;
+    std::atomic<bool> closed_;
     sem_t *semaphore;
-    
+
 };
 #else
+#include <climits>
+#include <unistd.h>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+
 class eventcount {
 public:
-    
-    eventcount() :  waiting(false) {
-        sem_init(&semaphore, 0, 0);
-    }
-    
-    ~eventcount() {
-        sem_destroy(&semaphore);
+    typedef uint32_t key_type;
+
+    eventcount() :  epoch(0), waiters(0), closed_(false) {
     }
-    
-    void prepare_wait() {
-        waiting.store(true, std::memory_order_seq_cst);
+
+    key_type prepare_wait() {
+        waiters.fetch_add(1, std::memory_order_seq_cst);
+        return epoch.load(std::memory_order_seq_cst);
     }
-    
+
     void cancel_wait() {
-        waiting.store(false, std::memory_order_release);
+        waiters.fetch_sub(1, std::memory_order_release);
     }
-    
-    void commit_wait() {
-        sem_wait(&semaphore);
+
+    void commit_wait(key_type key) {
+        // close() bumps the epoch after setting closed_, so either the
+        // futex sees a new epoch or we see closed_.
+        while (epoch.load(std::memory_order_acquire) == key &&
+               !closed_.load(std::memory_order_acquire)) {
+            futex(FUTEX_WAIT_PRIVATE, key);
+        }
+        waiters.fetch_sub(1, std::memory_order_release);
     }
-    
+
     void notify() {
-        if (waiting.load(std::memory_order_acquire)) {
-            waiting.store(false, std::memory_order_release);
-            sem_post(&semaphore);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (waiters.load(std::memory_order_relaxed)) {
+            epoch.fetch_add(1, std::memory_order_release);
+            futex(FUTEX_WAKE_PRIVATE, 1);
         }
     }
-    
+
+    void notify_all() {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (waiters.load(std::memory_order_relaxed)) {
+            epoch.fetch_add(1, std::memory_order_release);
+            futex(FUTEX_WAKE_PRIVATE, INT_MAX);
+        }
+    }
+
+    // one store, one increment and one FUTEX_WAKE, whatever the number
+    // of waiters.
+    void close() {
+        closed_.store(true, std::memory_order_seq_cst);
+        epoch.fetch_add(1, std::memory_order_seq_cst);
+        futex(FUTEX_WAKE_PRIVATE, INT_MAX);
+    }
+
+    bool closed() const {
+        return closed_.load(std::memory_order_acquire);
+    }
+
     template<typename FUNC>
-    auto out(FUNC func) -> decltype(func()) {
+    auto await(FUNC func) -> decltype(func()) {
         decltype(func()) result = func();
-        while (!result) {
-            prepare_wait();
+        while (!result && !closed()) {
+            key_type key = prepare_wait();
             result = func();
-            if (result) {
+            if (result || closed()) {
                 cancel_wait();
                 break;
             }
-            commit_wait();
+            commit_wait(key);
             result = func();
         }
         return result;
     }
-    
-    
+
+
 private:
-    
-    std::atomic<bool> waiting;
-    sem_t semaphore;
-    
+
+    long futex(int op, uint32_t val) {
+        return syscall(SYS_futex, reinterpret_cast<uint32_t*>(&epoch),
+                       op, val, nullptr, nullptr, 0);
+    }
+
+    std::atomic<uint32_t> epoch;
+    std::atomic<unsigned> waiters;
+    std::atomic<bool> closed_;
+
 };
 #endif /* end of __APPLE__ */
 #endif /* end of EVENTCOUNT_H */
@@ -0,0 +1,116 @@
+/*
+ * mpsc_queue<int> against the pointer-compressed mpsc_index_queue<int>.
+ *
+ * deep: one thread enqueues DEPTH elements, the resident set growth per
+ * element is printed, then the queue is drained and the dequeue cycles
+ * per element are printed. contended: PRODUCERS producers and one
+ * consumer run ITERS elements each through a shallow queue.
+ */
+
+#include <atomic>
+#include <cstdio>
+#include <iostream>
+#include <thread>
+#include <vector>
+#include <unistd.h>
+
+#include "mpsc_queue.h"
+#include "mpsc_index_queue.h"
+
+#define DEPTH (1 << 20)
+#define PRODUCERS 4
+#define ITERS 1000000
+
+static std::atomic<bool> g_start{false};
+
+static inline uint64_t rdtsc() {
+    uint64_t lo, hi;
+    __asm__ volatile ("rdtsc"
+            : "=a" (lo), "=d"(hi) /*outputs */
+            : /* no input parameters */
+            : "%ebx", "%ecx", "memory"); /* clobbers */
+    return lo | (hi << 32);
+}
+
+// resident set size in KiB, 0 where /proc is not available.
+static long rss_kb() {
+    long pages = 0, resident = 0;
+    FILE* f = fopen("/proc/self/statm", "r");
+    if (!f) {
+        return 0;
+    }
+    if (fscanf(f, "%ld %ld", &pages, &resident) != 2) {
+        resident = 0;
+    }
+    fclose(f);
+    return resident * (sysconf(_SC_PAGESIZE) / 1024);
+}
+
+template<typename queue_t>
+static void deep(char const* name) {
+    queue_t q;
+    long before = rss_kb();
+    for (int i = 0; i != DEPTH; ++i) {
+        q.enqueue(i);
+    }
+    long after = rss_kb();
+
+    int v;
+    uint64_t start = rdtsc();
+    while (q.dequeue(v)) {}
+    uint64_t end = rdtsc();
+
+    std::cout << name << " deep   bytes/element="
+        << (after - before) * 1024 / DEPTH
+        << " dequeue cycles/op=" << (end - start) / DEPTH << std::endl;
+}
+
+template<typename queue_t>
+static void producer(queue_t& q) {
+    while (!g_start.load(std::memory_order_relaxed)) {
+        std::this_thread::yield();
+    }
+    for (int i = 0; i != ITERS; ++i) {
+        while (!q.enqueue(i)) {
+            std::this_thread::yield();
+        }
+    }
+}
+
+template<typename queue_t>
+static void contended(char const* name) {
+    queue_t q;
+    g_start = false;
+    std::vector<std::thread> threads;
+    for (int i = 0; i != PRODUCERS; ++i) {
+        threads.push_back(std::thread(producer<queue_t>, std::ref(q)));
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+    int v;
+    uint64_t start = rdtsc();
+    g_start = true;
+    for (long n = 0; n != (long)PRODUCERS * ITERS; ) {
+        if (q.dequeue(v)) {
+            ++n;
+        } else {
+            std::this_thread::yield();
+        }
+    }
+    uint64_t end = rdtsc();
+    for (int i = 0; i != PRODUCERS; ++i) {
+        threads[i].join();
+    }
+    std::cout << name << " contended cycles/op="
+        << (end - start) / ((uint64_t)PRODUCERS * ITERS) << std::endl;
+}
+
+int main() {
+    std::cout << "node bytes: mpsc_queue=" << sizeof(mpsc_queue<int>::node_type)
+        << " mpsc_index_queue=" << mpsc_index_queue<int>::node_size() << std::endl;
+    deep<mpsc_queue<int> >("mpsc_queue      ");
+    deep<mpsc_index_queue<int> >("mpsc_index_queue");
+    contended<mpsc_queue<int> >("mpsc_queue      ");
+    contended<mpsc_index_queue<int> >("mpsc_index_queue");
+    return 0;
+}
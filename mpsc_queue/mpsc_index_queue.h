@@ -0,0 +1,250 @@
+#ifndef MPSC_INDEX_QUEUE_H
+#define MPSC_INDEX_QUEUE_H
+
+#include <atomic>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <new>
+
+#include "../mpmc_bounded_queue/buffer_allocation.h"
+
+/*
+ * mpsc_queue with pointer-compressed nodes.
+ *
+ * all nodes live in one arena mapped up front (transparent huge pages by
+ * default, faulted in as the queue grows) and link to each other with
+ * 32-bit indices instead of pointers, so a node of an int queue is 8
+ * bytes rather than 16. index 0 is the null link.
+ *
+ * the free list is a lock-free stack of indices whose head is one 64-bit
+ * word: the index in the low half and a generation in the high half that
+ * every update bumps, so the ABA tag costs nothing and no DWCAS is needed.
+ * the nodes never leave the arena and next_ is always an atomic, so a pop
+ * that reads next_ of a node another producer has just taken reads a
+ * stale index, not freed memory, and its CAS fails on the generation.
+ * producers take one node at a time; the consumer frees into a private
+ * chain and hands it over every `free_batch' nodes in one CAS.
+ *
+ * the arena is fixed and sized so that `capacity' elements always fit:
+ * next to them it holds the unused index 0, the stub and the up to
+ * free_batch - 1 nodes the consumer has freed but not handed over yet.
+ * enqueue fails when it runs out, as it does after close().
+ */
+template<typename T>
+class mpsc_index_queue {
+    struct node {
+        std::atomic<uint32_t> next_;
+        T value_;
+        node() : next_(0), value_() {}
+    };
+
+    static unsigned const free_batch = 32;
+    static size_t const closed_bit_ = ~(~(size_t)0 >> 1);
+    static size_t const open_ = ~(size_t)0;
+
+    mmap_allocation map_;
+    size_t const slots_; // arena nodes, index 0 included
+    node* nodes_;
+
+    // producer side
+    char pad0_[64];
+    std::atomic<uint32_t> head_;
+    char pad1_[64];
+    std::atomic<uint64_t> free_;  // generation << 32 | index
+    std::atomic<size_t> fresh_;   // next never-used index
+    char pad2_[64];
+    std::atomic<size_t> enqueued_;
+    std::atomic<size_t> closed_count_; // enqueued_ at close(), open_ before
+    char pad3_[64];
+
+    // consumer side
+    uint32_t tail_;
+    uint32_t local_first_;
+    uint32_t local_last_;
+    unsigned local_count_;
+    std::atomic<size_t> dequeued_;
+    char pad4_[64];
+
+#if __cplusplus >= 201703L
+    static_assert(std::atomic<uint64_t>::is_always_lock_free, "the free list needs a lock-free 64-bit word");
+#else
+    static_assert(ATOMIC_LLONG_LOCK_FREE == 2, "the free list needs a lock-free 64-bit word");
+#endif
+
+    static uint64_t pack(uint32_t index, uint64_t word)
+    {
+        return ((word >> 32) + 1) << 32 | index;
+    }
+
+    node& at(uint32_t index) const
+    {
+        return nodes_[index];
+    }
+
+    // 0 when the arena is exhausted.
+    uint32_t alloc_node()
+    {
+        uint64_t word = free_.load(std::memory_order_acquire);
+        for (;;) {
+            uint32_t index = (uint32_t)word;
+            if (! index) {
+                break;
+            }
+            uint32_t next = at(index).next_.load(std::memory_order_relaxed);
+            if (free_.compare_exchange_weak(word, pack(next, word),
+                    std::memory_order_acquire, std::memory_order_acquire)) {
+                return index;
+            }
+        }
+        if (fresh_.load(std::memory_order_relaxed) >= slots_) {
+            return 0;
+        }
+        size_t index = fresh_.fetch_add(1, std::memory_order_relaxed);
+        if (index >= slots_) {
+            return 0;
+        }
+        new (&at((uint32_t)index)) node;
+        return (uint32_t)index;
+    }
+
+    void push_free(uint32_t first, uint32_t last)
+    {
+        uint64_t word = free_.load(std::memory_order_relaxed);
+        do {
+            at(last).next_.store((uint32_t)word, std::memory_order_relaxed);
+        } while (! free_.compare_exchange_weak(word, pack(first, word),
+                    std::memory_order_release, std::memory_order_relaxed));
+    }
+
+    // consumer only.
+    void free_node(uint32_t index)
+    {
+        at(index).next_.store(local_first_, std::memory_order_relaxed);
+        local_first_ = index;
+        if (! local_last_) {
+            local_last_ = index;
+        }
+        if (++local_count_ == free_batch) {
+            push_free(local_first_, local_last_);
+            local_first_ = local_last_ = 0;
+            local_count_ = 0;
+        }
+    }
+
+public:
+    explicit mpsc_index_queue(size_t capacity = (size_t)1 << 24,
+                              unsigned map_flags = mmap_allocation::transparent_huge)
+        : map_(map_flags), slots_(capacity + 1 + free_batch), head_(0), free_(0), fresh_(1)
+        , enqueued_(0), closed_count_(open_), tail_(0), local_first_(0), local_last_(0), local_count_(0)
+        , dequeued_(0)
+    {
+        assert(capacity >= 1 && slots_ - 1 <= UINT32_MAX);
+        nodes_ = static_cast<node*>(map_.allocate(slots_ * sizeof(node)));
+        uint32_t stub = alloc_node();
+        head_.store(stub, std::memory_order_relaxed);
+        tail_ = stub;
+    }
+
+    ~mpsc_index_queue()
+    {
+        assert(head_.load(std::memory_order_relaxed) == tail_);
+        size_t fresh = fresh_.load(std::memory_order_relaxed);
+        if (fresh > slots_) {
+            fresh = slots_;
+        }
+        for (size_t i = 1; i != fresh; ++i) {
+            at((uint32_t)i).~node();
+        }
+        map_.deallocate(nodes_, slots_ * sizeof(node));
+    }
+
+    mpsc_index_queue(mpsc_index_queue const&) = delete;
+    void operator = (mpsc_index_queue const&) = delete;
+
+    bool enqueue(T const& value)
+    {
+        // the node comes before the reservation: one close() may have
+        // counted must not be taken back.
+        uint32_t n = alloc_node();
+        if (! n) {
+            return false;
+        }
+        if (enqueued_.fetch_add(1, std::memory_order_acq_rel) & closed_bit_) {
+            enqueued_.fetch_sub(1, std::memory_order_relaxed);
+            push_free(n, n);
+            return false;
+        }
+        at(n).value_ = value;
+        at(n).next_.store(0, std::memory_order_relaxed);
+        uint32_t p = head_.exchange(n, std::memory_order_acq_rel); // serialize producers
+        at(p).next_.store(n, std::memory_order_release); // serialize consumer
+        return true;
+    }
+
+    bool dequeue(T& value)
+    {
+        uint32_t t = tail_;
+        uint32_t n = at(t).next_.load(std::memory_order_acquire); // synchronize producer
+        if (! n) {
+            return false;
+        }
+        value = at(n).value_;
+        tail_ = n;
+        free_node(t);
+        dequeued_.store(dequeued_.load(std::memory_order_relaxed) + 1,
+                std::memory_order_release);
+        return true;
+    }
+
+    size_t size_approx() const
+    {
+        size_t deq = dequeued_.load(std::memory_order_relaxed);
+        size_t enq = enqueued_.load(std::memory_order_relaxed) & ~closed_bit_;
+        return enq > deq ? enq - deq : 0;
+    }
+
+    bool empty() const
+    {
+        return size_approx() == 0;
+    }
+
+    void close()
+    {
+        size_t enq = enqueued_.fetch_or(closed_bit_, std::memory_order_acq_rel);
+        if (!(enq & closed_bit_)) {
+            // the count has to be kept: producers turned away from now on
+            // still bump enqueued_ for a moment.
+            closed_count_.store(enq, std::memory_order_release);
+        }
+    }
+
+    bool is_closed() const
+    {
+        return (enqueued_.load(std::memory_order_acquire) & closed_bit_) != 0;
+    }
+
+    bool closed() const
+    {
+        size_t enq = closed_count_.load(std::memory_order_acquire);
+        if (enq == open_) {
+            return false;
+        }
+        return dequeued_.load(std::memory_order_acquire) >= enq;
+    }
+
+    // bytes per node in the arena.
+    static size_t node_size()
+    {
+        return sizeof(node);
+    }
+
+    // nodes carved from the arena so far, the high-water mark.
+    size_t nodes_used() const
+    {
+        size_t fresh = fresh_.load(std::memory_order_relaxed);
+        return (fresh > slots_ ? slots_ : fresh) - 1;
+    }
+};
+
+#endif /* end of MPSC_INDEX_QUEUE_H */
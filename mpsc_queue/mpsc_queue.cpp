@@ -2,70 +2,15 @@
 #include <atomic>
 #include <cassert>
 #include <memory>
+#include <functional>
 #include <thread>
 #include <iostream>
 
 #include "eventcount.h"
+#include "mpsc_queue.h"
 
 #include <emmintrin.h>
 
-template<typename T>
-class mpsc_queue {
-    struct node {
-        std::atomic<node*> next_;
-        T volatile value_;
-        node(T value, node *next = nullptr) : value_(value)
-        {
-            next_.store(next, std::memory_order_relaxed);
-        }
-    };
-
-    std::unique_ptr<node> stub_;
-    std::atomic<node*> head_;
-    std::atomic<node*> tail_;
-
-public:
-    mpsc_queue() : stub_(new node(0))
-    {
-        head_.store(stub_.get(), std::memory_order_relaxed);
-        tail_.store(stub_.get(), std::memory_order_relaxed);
-    }
-
-
-    ~mpsc_queue()
-    {
-        assert(head_.load(std::memory_order_relaxed) ==
-                            tail_.load(std::memory_order_relaxed));
-    }
-
-
-public:
-    void enqueue(T& value)
-    {
-        node* n = new node(value);
-        node* p = head_.exchange(n, std::memory_order_acq_rel); // serialize producers
-        /* if this thread dies, this will be the dangerous zone */
-        p->next_.store(n, std::memory_order_seq_cst); // serialize consumer
-        // head<-nodeN<-..node1<-tail
-    }
-
-
-    bool dequeue(T& value)
-    {
-        node* n;
-        node* t = tail_.load(std::memory_order_relaxed);
-        n = t->next_.load(std::memory_order_acquire); // synchrnize producer
-        if (n != nullptr) {
-            tail_.store(n, std::memory_order_relaxed);
-            value = n->value_;
-            free(t);
-            return true;
-        }
-        return false;
-    }
-};
-
-
 #define PRODUCERS 4
 #define CONSUMERS 1
 #define THREADS (PRODUCERS + CONSUMERS)
@@ -0,0 +1,264 @@
+#ifndef MPSC_QUEUE_H
+#define MPSC_QUEUE_H
+
+#include <atomic>
+#include <cassert>
+#include <cstddef>
+#include <memory>
+
+#include "../common/prefetch.h"
+#include "../proxy_collector/elimination_stack.h"
+
+/*
+ * alloc_t allocates the nodes and is rebound to the node type. any
+ * std::allocator-compatible allocator works, stateful ones included (pass
+ * it to the constructor), as long as it may be used from several threads
+ * at once: producers allocate concurrently and the consumer frees. with
+ * pool_allocator<T> from ../common/node_pool.h that turns into magazine
+ * hand-offs instead of cross-thread frees in malloc; arena_allocator<T>
+ * from ../common/node_arena.h keeps the nodes in a few huge pages.
+ *
+ * T_prefetch makes dequeue and dequeue_bulk prefetch the node after the
+ * one they return (../common/prefetch.h).
+ *
+ * reserve(n) switches the queue to cached nodes: n nodes are allocated up
+ * front, dequeued nodes go to a lock-free free stack instead of back to
+ * alloc_t, and producers take from there first. in strict mode enqueue
+ * never allocates and fails when the stack is empty. call both before the
+ * queue is shared.
+ */
+template<typename T, typename alloc_t = std::allocator<T>, bool T_prefetch = false>
+class mpsc_queue {
+    struct node {
+        std::atomic<node*> next_;
+        T volatile value_;
+        node(T value, node *next = nullptr) : value_(value)
+        {
+            next_.store(next, std::memory_order_relaxed);
+        }
+    };
+
+    typedef typename std::allocator_traits<alloc_t>::template rebind_alloc<node> node_alloc_t;
+    typedef std::allocator_traits<node_alloc_t> node_traits;
+
+    node_alloc_t alloc_;
+    std::atomic<node*> head_;
+    std::atomic<node*> tail_;
+
+    // depth counters. producers share enqueued_, which counts reservations
+    // and carries the closed bit; dequeued_ has a single writer and is
+    // bumped with a plain load/store.
+    char pad0_[64];
+    std::atomic<size_t> enqueued_;
+    std::atomic<size_t> closed_count_; // enqueued_ at close(), open_ before
+    char pad1_[64];
+    std::atomic<size_t> dequeued_;
+    char pad2_[64];
+
+    // nodes kept for reuse once reserve() was called. they stay with the
+    // queue, which is what the tagged stack needs.
+    elimination_stack<node, 0> cache_;
+    bool cached_;
+    bool strict_;
+
+    static size_t const closed_bit_ = ~(~(size_t)0 >> 1);
+    static size_t const open_ = ~(size_t)0;
+
+    node* new_node(T const& value)
+    {
+        node* n = node_traits::allocate(alloc_, 1);
+        node_traits::construct(alloc_, n, value);
+        return n;
+    }
+
+    void delete_node(node* n)
+    {
+        node_traits::destroy(alloc_, n);
+        node_traits::deallocate(alloc_, n, 1);
+    }
+
+    // nullptr only in strict mode.
+    node* acquire_node(T const& value)
+    {
+        if (cached_) {
+            if (node* n = cache_.pop()) {
+                n->next_.store(nullptr, std::memory_order_relaxed);
+                n->value_ = value;
+                return n;
+            }
+            if (strict_) {
+                return nullptr;
+            }
+        }
+        return new_node(value);
+    }
+
+    void release_node(node* n)
+    {
+        if (cached_) {
+            cache_.push(n);
+        } else {
+            delete_node(n);
+        }
+    }
+
+public:
+    typedef node node_type;
+
+    explicit mpsc_queue(alloc_t const& alloc = alloc_t())
+        : alloc_(alloc), enqueued_(0), closed_count_(open_), dequeued_(0), cached_(false), strict_(false)
+    {
+        node* stub = new_node(T());
+        head_.store(stub, std::memory_order_relaxed);
+        tail_.store(stub, std::memory_order_relaxed);
+    }
+
+
+    ~mpsc_queue()
+    {
+        assert(head_.load(std::memory_order_relaxed) ==
+                            tail_.load(std::memory_order_relaxed));
+        // the stub moves along with tail_, whatever tail_ points at now is
+        // the only node left.
+        delete_node(tail_.load(std::memory_order_relaxed));
+        node* n = cache_.flush();
+        while (n) {
+            node* next = n->next_.load(std::memory_order_relaxed);
+            delete_node(n);
+            n = next;
+        }
+    }
+
+
+public:
+    bool enqueue(T const& value)
+    {
+        // reserve before linking, so close() knows how many elements it
+        // has to wait for. the node comes first: a reservation close() may
+        // have counted must not be taken back.
+        node* n = acquire_node(value);
+        if (!n) {
+            return false;
+        }
+        if (enqueued_.fetch_add(1, std::memory_order_acq_rel) & closed_bit_) {
+            enqueued_.fetch_sub(1, std::memory_order_relaxed);
+            release_node(n);
+            return false;
+        }
+        node* p = head_.exchange(n, std::memory_order_acq_rel); // serialize producers
+        /* if this thread dies, this will be the dangerous zone */
+        p->next_.store(n, std::memory_order_seq_cst); // serialize consumer
+        // head<-nodeN<-..node1<-tail
+        return true;
+    }
+
+
+    bool dequeue(T& value)
+    {
+        node* n;
+        node* t = tail_.load(std::memory_order_relaxed);
+        n = t->next_.load(std::memory_order_acquire); // synchrnize producer
+        if (n != nullptr) {
+            tail_.store(n, std::memory_order_relaxed);
+            if (T_prefetch) {
+                prefetch_node(n->next_.load(std::memory_order_relaxed));
+            }
+            value = n->value_;
+            release_node(t);
+            dequeued_.store(dequeued_.load(std::memory_order_relaxed) + 1,
+                    std::memory_order_release);
+            return true;
+        }
+        return false;
+    }
+
+    // dequeue up to `max' elements into `values', returns how many. the
+    // counter is published once for the whole batch.
+    size_t dequeue_bulk(T* values, size_t max)
+    {
+        node* t = tail_.load(std::memory_order_relaxed);
+        size_t count = 0;
+        while (count != max) {
+            node* n = t->next_.load(std::memory_order_acquire); // synchronize producer
+            if (n == nullptr) {
+                break;
+            }
+            if (T_prefetch) {
+                prefetch_node(n->next_.load(std::memory_order_relaxed));
+            }
+            values[count++] = n->value_;
+            release_node(t);
+            t = n;
+        }
+        if (count) {
+            tail_.store(t, std::memory_order_relaxed);
+            dequeued_.store(dequeued_.load(std::memory_order_relaxed) + count,
+                    std::memory_order_release);
+        }
+        return count;
+    }
+
+    // allocate `n' nodes into the cache and use it from now on. the nodes
+    // are written, so their pages are faulted in here.
+    void reserve(size_t n)
+    {
+        cached_ = true;
+        for (size_t i = 0; i != n; ++i) {
+            cache_.push(new_node(T()));
+        }
+    }
+
+    // in strict mode enqueue only takes cached nodes and returns false when
+    // there is none. implies the cache.
+    void set_strict(bool strict)
+    {
+        strict_ = strict;
+        if (strict) {
+            cached_ = true;
+        }
+    }
+
+    // wait-free depth hint, callable from any thread.
+    size_t size_approx() const
+    {
+        size_t deq = dequeued_.load(std::memory_order_relaxed);
+        size_t enq = enqueued_.load(std::memory_order_relaxed) & ~closed_bit_;
+        return enq > deq ? enq - deq : 0;
+    }
+
+    bool empty() const
+    {
+        return size_approx() == 0;
+    }
+
+    // O(1) shutdown: enqueues fail from now on, dequeues keep draining
+    // what was enqueued before.
+    void close()
+    {
+        size_t enq = enqueued_.fetch_or(closed_bit_, std::memory_order_acq_rel);
+        if (!(enq & closed_bit_)) {
+            // the count has to be kept: producers turned away from now on
+            // still bump enqueued_ for a moment.
+            closed_count_.store(enq, std::memory_order_release);
+        }
+    }
+
+    bool is_closed() const
+    {
+        return (enqueued_.load(std::memory_order_acquire) & closed_bit_) != 0;
+    }
+
+    // true once the queue is closed and every element reserved before
+    // the close has been dequeued. it stays true, so a consumer whose
+    // dequeue failed can stop when it sees this.
+    bool closed() const
+    {
+        size_t enq = closed_count_.load(std::memory_order_acquire);
+        if (enq == open_) {
+            return false;
+        }
+        return dequeued_.load(std::memory_order_acquire) >= enq;
+    }
+};
+
+#endif /* end of MPSC_QUEUE_H */
@@ -0,0 +1,239 @@
+#ifndef MPSC_UNROLLED_QUEUE_H
+#define MPSC_UNROLLED_QUEUE_H
+
+#include <atomic>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <thread>
+
+#include "../proxy_collector/elimination_stack.h"
+
+/*
+ * mpsc_queue with unrolled nodes: every node holds T_slots values with a
+ * ready flag each, and a new node is linked only every T_slots elements.
+ *
+ * producers claim a slot in the head node with a CAS on its claim word,
+ * which packs the node's sequence number (high 48 bits) and the number of
+ * claimed slots (low 16 bits), then store the value and set the slot's
+ * ready flag. the producer whose claim finds the node full moves the count
+ * one past T_slots and appends the next node, with its own value already
+ * in slot 0; producers that find the node full in the meantime yield until
+ * the new node is published. the consumer reads slot after slot and stops
+ * at the first one that is not ready yet.
+ *
+ * nodes are type-stable: the consumer hands finished nodes to a free stack
+ * (elimination_stack) that appending producers take from, they go back to
+ * alloc_t only with the queue. a producer that read head_ before its node
+ * was finished and reused finds a different sequence number in the claim
+ * word, and its CAS fails instead of claiming a slot in the wrong node.
+ */
+template<typename T, size_t T_slots = 16, typename alloc_t = std::allocator<T> >
+class mpsc_unrolled_queue {
+    static_assert(T_slots > 0 && T_slots < 0xffff, "T_slots must fit the claim count");
+
+    struct slot {
+        T value_;
+        std::atomic<bool> ready_;
+        slot() : value_(), ready_(false) {}
+    };
+
+    struct node {
+        std::atomic<node*> next_; // queue link, free stack link once finished
+        std::atomic<uint64_t> claim_;
+        slot slots_[T_slots];
+        node() : next_(nullptr), claim_(0) {}
+    };
+
+    static unsigned const count_bits = 16;
+    static uint64_t const count_mask = ((uint64_t)1 << count_bits) - 1;
+    static uint64_t const appending = T_slots + 1;
+
+    typedef typename std::allocator_traits<alloc_t>::template rebind_alloc<node> node_alloc_t;
+    typedef std::allocator_traits<node_alloc_t> node_traits;
+
+    node_alloc_t alloc_;
+    elimination_stack<node> free_;
+
+    char pad0_[64];
+    std::atomic<node*> head_;
+    char pad1_[64];
+    std::atomic<size_t> enqueued_;
+    std::atomic<size_t> closed_count_; // enqueued_ at close(), open_ before
+    char pad2_[64];
+
+    // consumer part
+    node* tail_;
+    size_t read_;
+    std::atomic<size_t> dequeued_;
+    char pad3_[64];
+
+    static size_t const closed_bit_ = ~(~(size_t)0 >> 1);
+    static size_t const open_ = ~(size_t)0;
+
+    // a new node for sequence number `seq', with `value' in slot 0. nobody
+    // can claim in it until publish().
+    node* alloc_node(uint64_t seq, T const& value)
+    {
+        node* n = free_.pop();
+        if (! n) {
+            n = node_traits::allocate(alloc_, 1);
+            node_traits::construct(alloc_, n);
+        }
+        n->next_.store(nullptr, std::memory_order_relaxed);
+        n->claim_.store(seq << count_bits | appending, std::memory_order_relaxed);
+        n->slots_[0].value_ = value;
+        n->slots_[0].ready_.store(true, std::memory_order_relaxed);
+        return n;
+    }
+
+    void delete_node(node* n)
+    {
+        node_traits::destroy(alloc_, n);
+        node_traits::deallocate(alloc_, n, 1);
+    }
+
+    // consumer only, `n' is finished and unlinked.
+    void recycle(node* n)
+    {
+        for (size_t i = 0; i != T_slots; ++i) {
+            n->slots_[i].ready_.store(false, std::memory_order_relaxed);
+        }
+        free_.push(n);
+    }
+
+    void append(node* h, uint64_t claim, T const& value)
+    {
+        uint64_t seq = (claim >> count_bits) + 1;
+        node* n = alloc_node(seq, value);
+        h->next_.store(n, std::memory_order_release); // synchronize with consumer
+        head_.store(n, std::memory_order_release);
+        // open the node for claims only once it is the head, so nobody
+        // appends behind a node that is not linked yet.
+        n->claim_.store(seq << count_bits | 1, std::memory_order_release);
+    }
+
+public:
+    explicit mpsc_unrolled_queue(alloc_t const& alloc = alloc_t())
+        : alloc_(alloc), enqueued_(0), closed_count_(open_), read_(0), dequeued_(0)
+    {
+        node* n = node_traits::allocate(alloc_, 1);
+        node_traits::construct(alloc_, n);
+        head_.store(n, std::memory_order_relaxed);
+        tail_ = n;
+    }
+
+    ~mpsc_unrolled_queue()
+    {
+        node* n = tail_;
+        while (n) {
+            node* next = n->next_.load(std::memory_order_relaxed);
+            delete_node(n);
+            n = next;
+        }
+        n = free_.flush();
+        while (n) {
+            node* next = n->next_.load(std::memory_order_relaxed);
+            delete_node(n);
+            n = next;
+        }
+    }
+
+    mpsc_unrolled_queue(mpsc_unrolled_queue const&) = delete;
+    void operator = (mpsc_unrolled_queue const&) = delete;
+
+    bool enqueue(T const& value)
+    {
+        if (enqueued_.fetch_add(1, std::memory_order_acq_rel) & closed_bit_) {
+            enqueued_.fetch_sub(1, std::memory_order_relaxed);
+            return false;
+        }
+        for (;;) {
+            node* h = head_.load(std::memory_order_acquire);
+            uint64_t claim = h->claim_.load(std::memory_order_acquire);
+            uint64_t count = claim & count_mask;
+            if (count < T_slots) {
+                if (h->claim_.compare_exchange_weak(claim, claim + 1,
+                        std::memory_order_acq_rel, std::memory_order_relaxed)) {
+                    slot& s = h->slots_[count];
+                    s.value_ = value;
+                    s.ready_.store(true, std::memory_order_release); // synchronize with consumer
+                    return true;
+                }
+            } else if (count == T_slots) {
+                if (h->claim_.compare_exchange_strong(claim, claim + 1,
+                        std::memory_order_acq_rel, std::memory_order_relaxed)) {
+                    append(h, claim, value);
+                    return true;
+                }
+            } else {
+                // another producer is appending.
+                std::this_thread::yield();
+            }
+        }
+    }
+
+    bool dequeue(T& value)
+    {
+        node* t = tail_;
+        if (read_ == T_slots) {
+            node* n = t->next_.load(std::memory_order_acquire); // synchronize with appender
+            if (! n) {
+                return false;
+            }
+            // every slot of t was read, so the producers are done with it
+            // too: the appender wrote t->next_ last.
+            recycle(t);
+            tail_ = t = n;
+            read_ = 0;
+        }
+        slot& s = t->slots_[read_];
+        if (! s.ready_.load(std::memory_order_acquire)) { // synchronize with producer
+            return false;
+        }
+        value = s.value_;
+        ++read_;
+        dequeued_.store(dequeued_.load(std::memory_order_relaxed) + 1,
+                std::memory_order_release);
+        return true;
+    }
+
+    size_t size_approx() const
+    {
+        size_t deq = dequeued_.load(std::memory_order_relaxed);
+        size_t enq = enqueued_.load(std::memory_order_relaxed) & ~closed_bit_;
+        return enq > deq ? enq - deq : 0;
+    }
+
+    bool empty() const
+    {
+        return size_approx() == 0;
+    }
+
+    void close()
+    {
+        size_t enq = enqueued_.fetch_or(closed_bit_, std::memory_order_acq_rel);
+        if (!(enq & closed_bit_)) {
+            // the count has to be kept: producers turned away from now on
+            // still bump enqueued_ for a moment.
+            closed_count_.store(enq, std::memory_order_release);
+        }
+    }
+
+    bool is_closed() const
+    {
+        return (enqueued_.load(std::memory_order_acquire) & closed_bit_) != 0;
+    }
+
+    bool closed() const
+    {
+        size_t enq = closed_count_.load(std::memory_order_acquire);
+        if (enq == open_) {
+            return false;
+        }
+        return dequeued_.load(std::memory_order_acquire) >= enq;
+    }
+};
+
+#endif /* end of MPSC_UNROLLED_QUEUE_H */
@@ -0,0 +1,88 @@
+/*
+ * mpsc_queue with the global allocator versus the node pool from
+ * ../common/node_pool.h. producers allocate every node and the consumer
+ * frees it, the cross-thread pattern that is hardest on malloc; with the
+ * pool the consumer's frees come back to the producers as whole
+ * magazines. prints cycles per element and, for the pool, how many
+ * blocks it ever took from the system.
+ */
+
+#include <atomic>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+#include "mpsc_queue.h"
+#include "../common/node_pool.h"
+
+#define PRODUCERS 4
+#define ITERS 1000000
+
+static std::atomic<bool> g_start{false};
+
+static inline uint64_t rdtsc() {
+    uint64_t lo, hi;
+    __asm__ volatile ("rdtsc"
+            : "=a" (lo), "=d"(hi) /*outputs */
+            : /* no input parameters */
+            : "%ebx", "%ecx", "memory"); /* clobbers */
+    return lo | (hi << 32);
+}
+
+template<typename queue_t>
+static void producer(queue_t& q) {
+    while (!g_start.load(std::memory_order_relaxed)) {
+        std::this_thread::yield();
+    }
+    for (int i = 0; i != ITERS; ++i) {
+        q.enqueue(i);
+    }
+}
+
+template<typename queue_t>
+static void consumer(queue_t& q) {
+    int v;
+    for (long n = 0; n != (long)PRODUCERS * ITERS; ) {
+        if (q.dequeue(v)) {
+            ++n;
+        } else {
+            std::this_thread::yield();
+        }
+    }
+}
+
+template<typename queue_t>
+static uint64_t run() {
+    queue_t q;
+    g_start = false;
+
+    std::vector<std::thread> threads;
+    for (int i = 0; i != PRODUCERS; ++i) {
+        threads.push_back(std::thread(producer<queue_t>, std::ref(q)));
+    }
+    std::thread c(consumer<queue_t>, std::ref(q));
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+    uint64_t start = rdtsc();
+    g_start = true;
+    for (int i = 0; i != PRODUCERS; ++i) {
+        threads[i].join();
+    }
+    c.join();
+    uint64_t end = rdtsc();
+    return (end - start) / ((uint64_t)PRODUCERS * ITERS);
+}
+
+int main() {
+    typedef mpsc_queue<int> heap_queue;
+    typedef mpsc_queue<int, pool_allocator<int> > pool_queue;
+
+    for (int round = 0; round != 2; ++round) {
+        std::cout << "std::allocator  cycles/op=" << run<heap_queue>() << std::endl;
+        std::cout << "pool_allocator  cycles/op=" << run<pool_queue>()
+            << " pool blocks=" << pool_allocator<int>::rebind<
+                mpsc_queue<int, pool_allocator<int> >::node_type>::other::pool_type::get().capacity()
+            << std::endl;
+    }
+    return 0;
+}
@@ -0,0 +1,108 @@
+/*
+ * deep-queue dequeue throughput of the node queues with and without
+ * T_prefetch.
+ *
+ * before every run the heap is aged: DEPTH node-sized blocks are
+ * allocated and freed in random order, so the nodes of the queue come
+ * back scattered the way they are in a long-running process. the queue is
+ * then filled to DEPTH from one thread and drained from one thread, with
+ * dequeue() and with dequeue_bulk(BULK), either back to back or with
+ * WORK steps of dependent arithmetic per element standing in for the
+ * consumer's own work, which is what the prefetch overlaps with. prints
+ * dequeue cycles per element.
+ */
+
+#include <algorithm>
+#include <iostream>
+#include <random>
+#include <vector>
+
+#include "mpsc_queue.h"
+#include "../spsc_queue/spsc_queue.h"
+#include "../mpmc_unbounded_queue/mpmc_queue.h"
+
+#define DEPTH (1 << 20)
+#define BULK 64
+#define WORK 100
+
+static inline uint64_t rdtsc() {
+    uint64_t lo, hi;
+    __asm__ volatile ("rdtsc"
+            : "=a" (lo), "=d"(hi) /*outputs */
+            : /* no input parameters */
+            : "%ebx", "%ecx", "memory"); /* clobbers */
+    return lo | (hi << 32);
+}
+
+// allocated once: freeing a big vector here every run would make malloc
+// consolidate the freed blocks again.
+static std::vector<void*> blocks(DEPTH);
+
+static void age(size_t size) {
+    for (size_t i = 0; i != blocks.size(); ++i) {
+        blocks[i] = ::operator new(size);
+    }
+    std::shuffle(blocks.begin(), blocks.end(), std::mt19937(42));
+    for (size_t i = 0; i != blocks.size(); ++i) {
+        ::operator delete(blocks[i]);
+    }
+}
+
+static inline long consume(long sum, int v, int work) {
+    long x = v;
+    for (int i = 0; i != work; ++i) {
+        x = x * 31 + 7;
+    }
+    return sum + x;
+}
+
+static long volatile g_sink;
+
+template<typename queue_t>
+static uint64_t run(bool bulk, int work) {
+    age(sizeof(typename queue_t::node_type));
+    queue_t q;
+    for (int i = 0; i != DEPTH; ++i) {
+        q.enqueue(i);
+    }
+
+    long sum = 0;
+    uint64_t start = rdtsc();
+    if (bulk) {
+        int values[BULK];
+        while (size_t n = q.dequeue_bulk(values, BULK)) {
+            for (size_t i = 0; i != n; ++i) {
+                sum = consume(sum, values[i], work);
+            }
+        }
+    } else {
+        int v;
+        while (q.dequeue(v)) {
+            sum = consume(sum, v, work);
+        }
+    }
+    uint64_t end = rdtsc();
+    g_sink = sum;
+    return (end - start) / DEPTH;
+}
+
+template<typename plain_t, typename prefetch_t>
+static void compare(char const* name) {
+    for (int work = 0; work <= WORK; work += WORK) {
+        for (int bulk = 0; bulk != 2; ++bulk) {
+            uint64_t plain = run<plain_t>(bulk, work);
+            uint64_t prefetch = run<prefetch_t>(bulk, work);
+            std::cout << name << (bulk ? " dequeue_bulk" : " dequeue     ")
+                << " work=" << work
+                << " cycles/op plain=" << plain
+                << " prefetch=" << prefetch << std::endl;
+        }
+    }
+}
+
+int main() {
+    compare<spsc_queue<int>, spsc_queue<int, std::allocator<int>, true> >("spsc_queue");
+    compare<mpsc_queue<int>, mpsc_queue<int, std::allocator<int>, true> >("mpsc_queue");
+    compare<mpmc_queue<int>, mpmc_queue<int, proxy, std::allocator<int>, true> >("mpmc_queue");
+    return 0;
+}
@@ -0,0 +1,123 @@
+/*
+ * latency of the first OPS operations on a fresh queue, with and without
+ * reserving nodes up front.
+ *
+ * every row runs in its own forked process, so no row inherits nodes or
+ * faulted-in pages from an earlier one. the queue is constructed and
+ * prepared (reserve, set_strict, node_pool::reserve) outside the timed
+ * part, then OPS enqueues are timed one by one, followed by OPS dequeues.
+ * prints enqueue percentiles and max in cycles, average cycles per
+ * enqueue and dequeue and the minor page faults taken while timing.
+ */
+
+#include <algorithm>
+#include <iostream>
+#include <vector>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "mpsc_queue.h"
+#include "../common/node_pool.h"
+#include "../spsc_queue/spsc_queue.h"
+#include "../mpmc_unbounded_queue/mpmc_queue.h"
+#include "../mpmc_bounded_queue/mpmc_bounded_queue.h"
+
+#define OPS 100000
+
+static inline uint64_t rdtsc() {
+    uint64_t lo, hi;
+    __asm__ volatile ("rdtsc"
+            : "=a" (lo), "=d"(hi) /*outputs */
+            : /* no input parameters */
+            : "%ebx", "%ecx", "memory"); /* clobbers */
+    return lo | (hi << 32);
+}
+
+static long minor_faults() {
+    rusage u;
+    getrusage(RUSAGE_SELF, &u);
+    return u.ru_minflt;
+}
+
+template<typename queue_t>
+static void none(queue_t&) {}
+
+template<typename queue_t>
+static void reserve(queue_t& q) {
+    q.reserve(OPS);
+}
+
+template<typename queue_t>
+static void strict(queue_t& q) {
+    q.reserve(OPS);
+    q.set_strict(true);
+}
+
+template<typename queue_t>
+static void pool_reserve(queue_t&) {
+    pool_allocator<typename queue_t::node_type>::pool_type::reserve(OPS);
+}
+
+template<typename queue_t>
+static void run(char const* name, void (*prepare)(queue_t&)) {
+    std::cout.flush();
+    pid_t pid = fork();
+    if (pid != 0) {
+        waitpid(pid, nullptr, 0);
+        return;
+    }
+
+    std::vector<uint64_t> lat(OPS, 1); // written, so no faults while timing
+    queue_t q;
+    prepare(q);
+
+    long faults = minor_faults();
+    uint64_t start = rdtsc();
+    for (int i = 0; i != OPS; ++i) {
+        uint64_t t = rdtsc();
+        if (!q.enqueue(i)) {
+            std::cout << name << " enqueue failed at " << i << std::endl;
+            _exit(1);
+        }
+        lat[i] = rdtsc() - t;
+    }
+    uint64_t mid = rdtsc();
+    int v;
+    for (int i = 0; i != OPS; ++i) {
+        q.dequeue(v);
+    }
+    uint64_t end = rdtsc();
+    faults = minor_faults() - faults;
+
+    std::sort(lat.begin(), lat.end());
+    std::cout << name
+        << " enqueue p50=" << lat[OPS / 2]
+        << " p99=" << lat[OPS * 99 / 100]
+        << " p99.9=" << lat[OPS * 999 / 1000]
+        << " max=" << lat[OPS - 1]
+        << " avg=" << (mid - start) / OPS
+        << " dequeue avg=" << (end - mid) / OPS
+        << " faults=" << faults << std::endl;
+    _exit(0);
+}
+
+int main() {
+    typedef spsc_queue<int> spsc;
+    typedef mpsc_queue<int> mpsc;
+    typedef mpmc_queue<int> mpmc;
+    typedef mpmc_queue<int, proxy, pool_allocator<int> > mpmc_pool;
+    typedef mpmc_bounded_queue<int, (1 << 17)> bounded;
+
+    run<spsc>("spsc_queue          cold   ", none<spsc>);
+    run<spsc>("spsc_queue          reserve", reserve<spsc>);
+    run<spsc>("spsc_queue          strict ", strict<spsc>);
+    run<mpsc>("mpsc_queue          cold   ", none<mpsc>);
+    run<mpsc>("mpsc_queue          reserve", reserve<mpsc>);
+    run<mpsc>("mpsc_queue          strict ", strict<mpsc>);
+    run<mpmc>("mpmc_queue          cold   ", none<mpmc>);
+    run<mpmc_pool>("mpmc_queue (pool)   cold   ", none<mpmc_pool>);
+    run<mpmc_pool>("mpmc_queue (pool)   reserve", pool_reserve<mpmc_pool>);
+    run<bounded>("mpmc_bounded_queue  ring   ", none<bounded>);
+    return 0;
+}
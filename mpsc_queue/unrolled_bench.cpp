@@ -0,0 +1,134 @@
+/*
+ * unrolled node queues for a sweep of K (values per node) against the
+ * one-value-per-node spsc_queue and mpsc_queue.
+ *
+ * deep: one thread fills the queue to DEPTH and drains it again, printing
+ * cycles per enqueue+dequeue pair and node allocations per 1000 elements
+ * (a counting allocator sits under every queue). stream: producers and
+ * one consumer run ITERS elements each through a shallow queue, one
+ * producer for the spsc queues and PRODUCERS for the mpsc ones.
+ */
+
+#include <atomic>
+#include <iostream>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "mpsc_queue.h"
+#include "mpsc_unrolled_queue.h"
+#include "../spsc_queue/spsc_queue.h"
+#include "../spsc_queue/spsc_unrolled_queue.h"
+
+#define DEPTH (1 << 20)
+#define ITERS 1000000
+#define PRODUCERS 4
+
+static std::atomic<size_t> g_allocs{0};
+static std::atomic<bool> g_start{false};
+
+template<typename T>
+struct counting_allocator : std::allocator<T>
+{
+    template<typename U> struct rebind { typedef counting_allocator<U> other; };
+
+    counting_allocator() {}
+    template<typename U> counting_allocator(counting_allocator<U> const&) {}
+
+    T* allocate(size_t n)
+    {
+        g_allocs.fetch_add(1, std::memory_order_relaxed);
+        return std::allocator<T>::allocate(n);
+    }
+};
+
+static inline uint64_t rdtsc() {
+    uint64_t lo, hi;
+    __asm__ volatile ("rdtsc"
+            : "=a" (lo), "=d"(hi) /*outputs */
+            : /* no input parameters */
+            : "%ebx", "%ecx", "memory"); /* clobbers */
+    return lo | (hi << 32);
+}
+
+template<typename queue_t>
+static void deep(queue_t& q, uint64_t& cycles, size_t& allocs) {
+    int v;
+    g_allocs = 0;
+    uint64_t start = rdtsc();
+    for (int i = 0; i != DEPTH; ++i) {
+        q.enqueue(i);
+    }
+    while (q.dequeue(v)) {}
+    cycles = (rdtsc() - start) / DEPTH;
+    allocs = g_allocs.load() * 1000 / DEPTH;
+}
+
+template<typename queue_t>
+static void producer(queue_t& q) {
+    while (!g_start.load(std::memory_order_relaxed)) {
+        std::this_thread::yield();
+    }
+    for (int i = 0; i != ITERS; ++i) {
+        q.enqueue(i);
+    }
+}
+
+template<typename queue_t>
+static uint64_t stream(queue_t& q, int producers) {
+    g_start = false;
+    std::vector<std::thread> threads;
+    for (int i = 0; i != producers; ++i) {
+        threads.push_back(std::thread(producer<queue_t>, std::ref(q)));
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+    int v;
+    uint64_t start = rdtsc();
+    g_start = true;
+    for (long n = 0; n != (long)producers * ITERS; ) {
+        if (q.dequeue(v)) {
+            ++n;
+        } else {
+            std::this_thread::yield();
+        }
+    }
+    uint64_t end = rdtsc();
+    for (int i = 0; i != producers; ++i) {
+        threads[i].join();
+    }
+    return (end - start) / ((uint64_t)producers * ITERS);
+}
+
+template<typename queue_t>
+static void row(char const* name, size_t k, int producers) {
+    uint64_t cycles;
+    size_t allocs;
+    {
+        queue_t q;
+        deep(q, cycles, allocs);
+    }
+    queue_t q;
+    uint64_t s = stream(q, producers);
+    std::cout << name << " K=" << k
+        << " deep cycles/op=" << cycles
+        << " allocs/1000=" << allocs
+        << " stream cycles/op=" << s << std::endl;
+}
+
+int main() {
+    typedef counting_allocator<int> A;
+
+    row<spsc_queue<int, A> >("spsc_queue         ", 1, 1);
+    row<spsc_unrolled_queue<int, 4, A> >("spsc_unrolled_queue", 4, 1);
+    row<spsc_unrolled_queue<int, 16, A> >("spsc_unrolled_queue", 16, 1);
+    row<spsc_unrolled_queue<int, 64, A> >("spsc_unrolled_queue", 64, 1);
+    row<spsc_unrolled_queue<int, 256, A> >("spsc_unrolled_queue", 256, 1);
+
+    row<mpsc_queue<int, A> >("mpsc_queue         ", 1, PRODUCERS);
+    row<mpsc_unrolled_queue<int, 4, A> >("mpsc_unrolled_queue", 4, PRODUCERS);
+    row<mpsc_unrolled_queue<int, 16, A> >("mpsc_unrolled_queue", 16, PRODUCERS);
+    row<mpsc_unrolled_queue<int, 64, A> >("mpsc_unrolled_queue", 64, PRODUCERS);
+    row<mpsc_unrolled_queue<int, 256, A> >("mpsc_unrolled_queue", 256, PRODUCERS);
+    return 0;
+}
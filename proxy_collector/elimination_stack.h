@@ -0,0 +1,198 @@
+#ifndef ELIMINATION_STACK_H
+#define ELIMINATION_STACK_H
+
+#include <atomic>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+
+/*
+ * lock-free stack with a tagged head and an elimination array.
+ *
+ * the head is one 64-bit word: the node pointer and a tag above it that
+ * every successful update bumps, so a pop that read the head before the
+ * same node was popped and pushed back fails its CAS instead of installing
+ * a stale next_ (ABA). the pointer is stored without its low zero bits, so
+ * the tag gets 16 bits plus log2(alignof(T_node)): 19 bits for a node that
+ * holds an atomic next_ pointer, more for cache-line aligned blocks. that
+ * is a bound, not a proof: a pop that stalls between its load and its CAS
+ * while exactly a multiple of 2^19 (or 2^tag bits) updates go by can still
+ * be fooled. it needs x86-64/aarch64 style 48-bit user addresses, and
+ * nodes that stay mapped while the stack is in use (a pool, a free list, a
+ * proxy): pop reads next_ of a node another thread may just have taken.
+ *
+ * when the head CAS fails, push and pop meet in a small elimination
+ * array instead of retrying on the head right away: a push parks its node
+ * in a random slot for a short while, a pop that finds a parked node takes
+ * it, and the pair completes without touching head_. T_slots = 0 turns
+ * elimination off.
+ */
+template<typename T_node, size_t T_slots = 8, unsigned T_spin = 64>
+class elimination_stack
+{
+    static_assert(sizeof(void*) == 8, "the tagged head needs 64-bit pointers");
+
+    static unsigned const addr_bits = 48;
+
+    static constexpr unsigned log2(size_t n)
+    {
+        return n <= 1 ? 0 : 1 + log2(n / 2);
+    }
+
+    // functions rather than constants: T_node may still be incomplete
+    // where the stack is declared as a member.
+    static constexpr unsigned align_bits()
+    {
+        return log2(alignof(T_node));
+    }
+
+    static constexpr uint64_t ptr_mask()
+    {
+        return ((uint64_t)1 << (addr_bits - align_bits())) - 1;
+    }
+
+    // a slot holds nothing, a parked node, or `taken' while the pop that
+    // took the node waits for its pusher to notice.
+    struct alignas(64) slot
+    {
+        std::atomic<T_node*> node_;
+        slot() : node_(nullptr) {}
+    };
+
+    alignas(64) std::atomic<uint64_t> head_;
+    slot slots_[T_slots ? T_slots : 1];
+
+    static T_node* taken()
+    {
+        return reinterpret_cast<T_node*>(1);
+    }
+
+    static T_node* ptr(uint64_t word)
+    {
+        return reinterpret_cast<T_node*>((word & ptr_mask()) << align_bits());
+    }
+
+    // new head word for `p', one tag step on from `word'.
+    static uint64_t next_word(uint64_t word, T_node* p)
+    {
+        uint64_t bits = (uintptr_t)p >> align_bits();
+        assert((bits & ~ptr_mask()) == 0 && (bits << align_bits()) == (uintptr_t)p);
+        return ((word & ~ptr_mask()) + ptr_mask() + 1) | bits;
+    }
+
+    static slot* pick(slot* slots)
+    {
+        static thread_local uint32_t seed = 0;
+        if (seed == 0) {
+            seed = (uint32_t)(uintptr_t)&seed | 1;
+        }
+        seed ^= seed << 13;
+        seed ^= seed >> 17;
+        seed ^= seed << 5;
+        return &slots[seed % (T_slots ? T_slots : 1)];
+    }
+
+    bool try_push(T_node* first, T_node* last)
+    {
+        uint64_t head = head_.load(std::memory_order_relaxed);
+        last->next_.store(ptr(head), std::memory_order_relaxed);
+        return head_.compare_exchange_strong(head, next_word(head, first),
+            std::memory_order_release, std::memory_order_relaxed);
+    }
+
+    bool try_pop(T_node*& n)
+    {
+        uint64_t head = head_.load(std::memory_order_acquire);
+        n = ptr(head);
+        if (! n) return true;
+        T_node* next = n->next_.load(std::memory_order_relaxed);
+        return head_.compare_exchange_strong(head, next_word(head, next),
+            std::memory_order_acquire, std::memory_order_relaxed);
+    }
+
+    // park `n' for a pop to take; false if nobody did.
+    bool eliminate_push(T_node* n)
+    {
+        slot* s = pick(slots_);
+        T_node* expected = nullptr;
+        if (! s->node_.compare_exchange_strong(expected, n, std::memory_order_release, std::memory_order_relaxed)) {
+            return false;
+        }
+        for (unsigned i = 0; i != T_spin; ++i) {
+            if (s->node_.load(std::memory_order_relaxed) != n) {
+                break;
+            }
+        }
+        expected = n;
+        if (s->node_.compare_exchange_strong(expected, nullptr, std::memory_order_relaxed)) {
+            return false; // withdrawn
+        }
+        // taken; hand the slot back.
+        s->node_.store(nullptr, std::memory_order_release);
+        return true;
+    }
+
+    T_node* eliminate_pop()
+    {
+        slot* s = pick(slots_);
+        T_node* n = s->node_.load(std::memory_order_acquire);
+        if (n && n != taken() &&
+                s->node_.compare_exchange_strong(n, taken(), std::memory_order_acquire, std::memory_order_relaxed)) {
+            return n;
+        }
+        return nullptr;
+    }
+
+public:
+    elimination_stack() : head_(0) {}
+
+    elimination_stack(elimination_stack const&) = delete;
+    void operator = (elimination_stack const&) = delete;
+
+    void push(T_node* n)
+    {
+        while (! try_push(n, n))
+        {
+            if (T_slots && eliminate_push(n)) {
+                return;
+            }
+        }
+    }
+
+    // push the chain `first'..`last', already linked through next_, in
+    // one step. chains don't take part in elimination.
+    void push_chain(T_node* first, T_node* last)
+    {
+        while (! try_push(first, last)) {}
+    }
+
+    T_node* pop()
+    {
+        T_node* n;
+        while (! try_pop(n))
+        {
+            if (T_slots) {
+                if (T_node* e = eliminate_pop()) {
+                    return e;
+                }
+            }
+        }
+        return n;
+    }
+
+    // take the whole stack, linked through next_.
+    T_node* flush()
+    {
+        uint64_t head = head_.load(std::memory_order_relaxed);
+        while (ptr(head) && ! head_.compare_exchange_weak(head, next_word(head, nullptr),
+                std::memory_order_acquire, std::memory_order_relaxed)) {}
+        return ptr(head);
+    }
+
+    T_node* get_head() const
+    {
+        return ptr(head_.load(std::memory_order_acquire));
+    }
+};
+
+#endif /* end of ELIMINATION_STACK_H */
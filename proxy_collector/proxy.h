@@ -0,0 +1,470 @@
+/*
+ * Word-Based Portable Proxy Garbage Collector
+ * Copyright (C) 2010 Christopher Michael Thomasson
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef PROXY_H
+#define PROXY_H
+
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <atomic>
+#include <chrono>
+
+#include "../common/defer_node.h"
+
+// default policy for objects the proxy is done with.
+template<typename T_node>
+struct proxy_delete
+{
+    void operator()(T_node* n) const
+    {
+        delete n;
+    }
+};
+
+/*
+ * T_node is any type deriving from defer_node, the intrusive hook the
+ * proxy links deferred objects through. T_dispose is called for every
+ * object once it is safe to reuse; a policy holding a pointer to a pool
+ * recycles nodes instead of freeing them:
+ *
+ *     struct to_pool {
+ *         my_pool* pool_;
+ *         void operator()(my_node* n) const { pool_->put(n); }
+ *     };
+ *     proxy<64, 4, my_node, to_pool> p(to_pool{&pool});
+ *
+ * an object retired through guard::retire() with its own free function
+ * goes to that function instead.
+ */
+template<size_t T_defer_limit, size_t T_collector_size,
+         typename T_node, typename T_dispose = proxy_delete<T_node> >
+class proxy
+{
+    // current_ and collector::count_ are one 64-bit word each: the low
+    // INDEX_BITS hold the collector index (current_ only), the next bit is
+    // the quiesce flag and everything above counts references, so there is
+    // room for 2^16 collectors and still more than 2^40 references. a
+    // 64-bit fetch_add costs what a 32-bit one does.
+    typedef uint64_t word_type;
+
+    static constexpr unsigned prv_log2(size_t n)
+    {
+        return n <= 1 ? 0 : 1 + prv_log2(n / 2);
+    }
+
+    static constexpr unsigned INDEX_BITS = prv_log2(T_collector_size);
+    static constexpr word_type INDEX_MASK = T_collector_size - 1;
+    static constexpr word_type QUIESCE = (word_type)1 << INDEX_BITS;
+    static constexpr word_type REFERENCE = QUIESCE << 1;
+
+    static_assert(T_collector_size >= 2 && T_collector_size <= 65536 &&
+        (T_collector_size & (T_collector_size - 1)) == 0,
+        "number of collectors must be a power of two between 2 and 65536");
+#if __cplusplus >= 201703L
+    static_assert(std::atomic<word_type>::is_always_lock_free,
+        "the reference word must be lock-free");
+#else
+    static_assert(ATOMIC_LLONG_LOCK_FREE == 2,
+        "the reference word must be lock-free");
+#endif
+
+public:
+    typedef T_node node_type;
+
+private:
+    T_dispose dispose_;
+
+    void prv_destroy(defer_node* n)
+    {
+        while (n)
+        {
+            defer_node* next = n->defer_next_;
+            if (n->defer_free_) {
+                n->defer_free_(n);
+            } else {
+                dispose_(static_cast<T_node*>(n));
+            }
+            n = next;
+        }
+    }
+
+public:
+    class collector
+    {
+    friend class proxy;
+   
+   
+    private:
+        std::atomic<T_node*> defer_;
+        std::atomic<unsigned int> defer_count_;
+        std::atomic<word_type> count_;
+        std::atomic<int64_t> since_; // first defer into this collection
+   
+    public:
+        collector() : defer_(nullptr), defer_count_(0), count_(0), since_(0) {}
+    };
+
+
+    // called from collect() when a collector's defer count reaches `at_',
+    // see proxy_reaper in reaper.h.
+    struct waker
+    {
+        void (*fn_)(void*);
+        void* ctx_;
+        unsigned at_;
+    };
+
+
+private:
+    // index for collector array
+    std::atomic<word_type> current_;
+    std::atomic<bool> quiesce_;
+    T_node* defer_;
+    collector collectors_[T_collector_size];
+    
+    // the back-linked objects in `defer_', and reclamation lag stats.
+    std::atomic<size_t> defer_held_;
+    int64_t defer_since_;
+    std::atomic<int64_t> last_lag_;
+    std::atomic<int64_t> max_lag_;
+    std::atomic<waker const*> waker_;
+
+    static int64_t prv_now()
+    {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+public:
+    explicit proxy(T_dispose dispose = T_dispose())
+        : dispose_(dispose), current_(0), quiesce_(false), defer_(nullptr),
+          defer_held_(0), defer_since_(0), last_lag_(0), max_lag_(0), waker_(nullptr) {}
+
+    ~proxy()
+    {
+        for (size_t i = 0; i < T_collector_size; ++i) {
+            prv_destroy(collectors_[i].defer_.load(std::memory_order_relaxed));
+        }
+        prv_destroy(defer_);
+    }
+
+private:
+    void prv_quiesce_begin()
+    {
+        // Try to begin the quiescence process.
+        if (! quiesce_.exchange(true, std::memory_order_acquire))
+        {
+            // advance the current collector and grab the old one.
+            word_type old = current_.load(std::memory_order_relaxed) & INDEX_MASK;
+            old = current_.exchange((old + 1) & INDEX_MASK, std::memory_order_acq_rel);
+            collector& c = collectors_[old & INDEX_MASK];
+            
+            // decode reference count.
+            word_type refs = old & ~INDEX_MASK;
+            
+            // verify reference count and previous collector index.
+            assert(! (refs & QUIESCE) && (old & INDEX_MASK) == (word_type)(&c - collectors_));
+            
+            // increment and generate an odd reference count.
+            if (c.count_.fetch_add(refs + QUIESCE, std::memory_order_release) == -refs)
+            {
+                // odd reference count and drop-to-zero condition detected!
+                prv_quiesce_complete(c);
+            }
+        }
+    }
+
+
+    void prv_quiesce_complete(collector& c)
+    {
+        // the collector `c' is now in a quiescent state! :^)
+        std::atomic_thread_fence(std::memory_order_acquire);
+        
+        // maintain the back link and obtain "fresh" objects from
+        // this collection.
+        T_node* n = defer_;
+        defer_ = c.defer_.load(std::memory_order_relaxed);
+        c.defer_.store(0, std::memory_order_relaxed);
+        
+        // `n' waited since its first object was deferred.
+        if (n) {
+            int64_t lag = prv_now() - defer_since_;
+            last_lag_.store(lag, std::memory_order_relaxed);
+            if (lag > max_lag_.load(std::memory_order_relaxed)) {
+                max_lag_.store(lag, std::memory_order_relaxed);
+            }
+        }
+        defer_since_ = c.since_.load(std::memory_order_relaxed);
+        defer_held_.store(c.defer_count_.load(std::memory_order_relaxed), std::memory_order_relaxed);
+        
+        // verify and reset the reference count.
+        assert(c.count_.load(std::memory_order_relaxed) == QUIESCE);
+        c.count_.store(0, std::memory_order_relaxed);
+        c.defer_count_.store(0, std::memory_order_relaxed);
+        
+        // release the quiesce lock.
+        quiesce_.store(false, std::memory_order_release);
+        
+        // destroy nodes.
+        prv_destroy(n);
+    }
+
+public:
+    collector& acquire()
+    {
+        // increment the master count _and_ obtain current collector.
+        word_type current =
+        current_.fetch_add(REFERENCE, std::memory_order_acquire);
+    
+        // decode the collector index.
+        return collectors_[current & INDEX_MASK];
+    }
+
+
+    void release(collector& c)
+    {
+        // decrement the collector.
+        word_type count =
+        c.count_.fetch_sub(REFERENCE, std::memory_order_release);
+    
+        // check for the completion of the quiescence process.
+        if ((count & ~INDEX_MASK) == REFERENCE + QUIESCE) {
+            // odd reference count and drop-to-zero condition detected!
+            prv_quiesce_complete(c);
+        }
+    }
+
+
+    collector& sync(collector& c)
+    {
+        // check if the `c' is in the middle of a quiescence process.
+        if (c.count_.load(std::memory_order_relaxed) & QUIESCE) {
+            // drop `c' and get the next collector.
+            release(c);
+    
+            return acquire();
+        }
+    
+        return c;
+    }
+
+
+    void collect()
+    {
+        prv_quiesce_begin();
+    }
+
+
+    void collect(collector& c, T_node* n)
+    {
+        prv_collect(c, n, nullptr);
+    }
+
+
+    // objects deferred and not disposed of yet, approximate.
+    size_t pending() const
+    {
+        size_t n = defer_held_.load(std::memory_order_relaxed);
+        for (size_t i = 0; i < T_collector_size; ++i) {
+            n += collectors_[i].defer_count_.load(std::memory_order_relaxed);
+        }
+        return n;
+    }
+
+
+    // time from the first deferral into a collection to its disposal, for
+    // the most recent collection and the worst one so far.
+    std::chrono::nanoseconds reclaim_lag() const
+    {
+        return std::chrono::nanoseconds(last_lag_.load(std::memory_order_relaxed));
+    }
+
+    std::chrono::nanoseconds max_reclaim_lag() const
+    {
+        return std::chrono::nanoseconds(max_lag_.load(std::memory_order_relaxed));
+    }
+
+
+    // `w' must stay valid until it is replaced; nullptr turns it off.
+    void set_waker(waker const* w)
+    {
+        waker_.store(w, std::memory_order_release);
+    }
+
+
+private:
+    void prv_collect(collector& c, T_node* n, void (*free_fn)(defer_node*))
+    {
+        if (! n) return;
+        
+        // a recycled node may still carry the free function of its last
+        // life.
+        n->defer_free_ = free_fn;
+        
+        // link node into the defer list.
+        T_node* prev = c.defer_.exchange(n, std::memory_order_relaxed);
+        n->defer_next_ = prev;
+        
+        // bump the defer count and begin quiescence process if over
+        // the limit.
+        unsigned int count =
+        c.defer_count_.fetch_add(1, std::memory_order_relaxed) + 1;
+        
+        // we hold `c', so the collection can't complete under us.
+        if (count == 1) {
+            c.since_.store(prv_now(), std::memory_order_relaxed);
+        }
+        
+        waker const* w = waker_.load(std::memory_order_acquire);
+        if (w && count == w->at_) {
+            w->fn_(w->ctx_);
+        }
+        
+        if (count >= (T_defer_limit / 2))
+        {
+            prv_quiesce_begin();
+        }
+    }
+
+
+public:
+    class read_guard;
+
+    // long-lived read-side handle, one per thread (e.g. thread_local). it
+    // keeps a collector reference between critical sections and only
+    // trades it for the current one when it sees it quiescing, so entering
+    // is a relaxed load and leaving touches nothing shared. sections nest
+    // on a plain depth count. the reference pins the collector while the
+    // thread is idle too; call offline() before blocking for long.
+    class reader
+    {
+        friend class read_guard;
+
+        proxy& proxy_;
+        collector* c_;
+        unsigned depth_;
+
+    public:
+        explicit reader(proxy& p) : proxy_(p), c_(nullptr), depth_(0) {}
+        ~reader() { offline(); }
+
+        reader(reader const&) = delete;
+        void operator = (reader const&) = delete;
+
+        void enter()
+        {
+            if (depth_++ == 0)
+            {
+                if (! c_) {
+                    c_ = &proxy_.acquire();
+                } else if (c_->count_.load(std::memory_order_relaxed) & QUIESCE) {
+                    proxy_.release(*c_);
+                    c_ = &proxy_.acquire();
+                }
+            }
+        }
+
+        void leave()
+        {
+            assert(depth_);
+            --depth_;
+        }
+
+        // drop the reference, outside a critical section only.
+        void offline()
+        {
+            if (c_ && ! depth_) {
+                proxy_.release(*c_);
+                c_ = nullptr;
+            }
+        }
+
+        collector& get()
+        {
+            assert(depth_);
+            return *c_;
+        }
+    };
+
+
+    // critical section on a reader, with the guard interface below.
+    class read_guard
+    {
+        reader& r_;
+
+    public:
+        explicit read_guard(reader& r) : r_(r) { r_.enter(); }
+        ~read_guard() { r_.leave(); }
+
+        read_guard(read_guard const&) = delete;
+        void operator = (read_guard const&) = delete;
+
+        template<typename N>
+        N* protect(unsigned, std::atomic<N*> const& src)
+        {
+            return src.load(std::memory_order_acquire);
+        }
+
+        template<typename N>
+        void publish(unsigned, N*) {}
+
+        void retire(T_node* n, void (*free_fn)(defer_node*))
+        {
+            r_.proxy_.prv_collect(r_.get(), n, free_fn);
+        }
+
+        void collect(T_node* n)
+        {
+            r_.proxy_.collect(r_.get(), n);
+        }
+    };
+
+
+public:
+    // scoped region with the interface shared by the reclamation schemes
+    // (see hazard_pointer/hazard_pointer.h).
+    class guard
+    {
+        proxy& proxy_;
+        collector* c_;
+
+    public:
+        explicit guard(proxy& p) : proxy_(p), c_(&p.acquire()) {}
+        ~guard() { proxy_.release(*c_); }
+
+        guard(guard const&) = delete;
+        void operator = (guard const&) = delete;
+
+        template<typename N>
+        N* protect(unsigned, std::atomic<N*> const& src)
+        {
+            return src.load(std::memory_order_acquire);
+        }
+
+        template<typename N>
+        void publish(unsigned, N*) {}
+
+        void retire(T_node* n, void (*free_fn)(defer_node*))
+        {
+            proxy_.prv_collect(*c_, n, free_fn);
+        }
+    };
+};
+
+#endif /* end of PROXY_H */
@@ -22,240 +22,23 @@
 #include <array>
 #include <atomic>
 #include <thread>
+#include <vector>
 #include <iostream>
 
-struct node
-{
-    std::atomic<node*> next_;
-    node* defer_next_;
-};
-
-template<size_t T_defer_limit, size_t T_collector_size = 4>
-class proxy
-{
-    static void prv_destroy(node* n)
-    {
-        while (n)
-        {
-            node* next = n->defer_next_;
-            delete n;
-            n = next;
-        }
-    }
-
-public:
-    class collector
-    {
-    friend class proxy;
-   
-   
-    private:
-        std::atomic<node*> defer_;
-        std::atomic<unsigned int> defer_count_;
-        std::atomic<unsigned int> count_;
-   
-    public:
-        collector() : defer_(nullptr), defer_count_(0), count_(0) {}
-   
-        ~collector()
-        {
-            prv_destroy(defer_.load(std::memory_order_relaxed));
-        }
-    };
-
-
-private:
-    // index for collector array
-    std::atomic<unsigned int> current_;
-    std::atomic<bool> quiesce_;
-    node* defer_;
-    collector collectors_[T_collector_size];
-    unsigned collector_size_mask_;
-    static_assert(T_collector_size >= 2 && T_collector_size <= 16, 
-        "number of collectors must be between 2 and 16");
-
-public:
-    proxy() : current_(0), quiesce_(false), defer_(nullptr),
-                collector_size_mask_(T_collector_size - 1) {}
-
-    ~proxy()
-    {
-        prv_destroy(defer_);
-    }
-
-private:
-    void prv_quiesce_begin()
-    {
-        // Try to begin the quiescence process.
-        if (! quiesce_.exchange(true, std::memory_order_acquire))
-        {
-            // advance the current collector and grab the old one.
-            unsigned int old = current_.load(std::memory_order_relaxed) & 0xFU;
-            old = current_.exchange((old + 1) & collector_size_mask_, std::memory_order_acq_rel);
-            collector& c = collectors_[old & 0xFU];
-            
-            // decode reference count.
-            unsigned int refs = old & 0xFFFFFFF0U;
-            
-            // verify reference count and previous collector index.
-            assert(! (refs & 0x10U) && (old & 0xFU) == (&c - collectors_));
-            
-            // increment and generate an odd reference count.
-            if (c.count_.fetch_add(refs + 0x10U, std::memory_order_release) == -refs)
-            {
-                // odd reference count and drop-to-zero condition detected!
-                prv_quiesce_complete(c);
-            }
-        }
-    }
-
-
-    void prv_quiesce_complete(collector& c)
-    {
-        // the collector `c' is now in a quiescent state! :^)
-        std::atomic_thread_fence(std::memory_order_acquire);
-        
-        // maintain the back link and obtain "fresh" objects from
-        // this collection.
-        node* n = defer_;
-        defer_ = c.defer_.load(std::memory_order_relaxed);
-        c.defer_.store(0, std::memory_order_relaxed);
-        
-        // verify and reset the reference count.
-        assert(c.count_.load(std::memory_order_relaxed) == 0x10U);
-        c.count_.store(0, std::memory_order_relaxed);
-        c.defer_count_.store(0, std::memory_order_relaxed);
-        
-        // release the quiesce lock.
-        quiesce_.store(false, std::memory_order_release);
-        
-        // destroy nodes.
-        prv_destroy(n);
-    }
-
-public:
-    collector& acquire()
-    {
-        // increment the master count _and_ obtain current collector.
-        unsigned int current =
-        current_.fetch_add(0x20U, std::memory_order_acquire);
-    
-        // decode the collector index.
-        return collectors_[current & 0xFU];
-    }
-
-
-    void release(collector& c)
-    {
-        // decrement the collector.
-        unsigned int count =
-        c.count_.fetch_sub(0x20U, std::memory_order_release);
-    
-        // check for the completion of the quiescence process.
-        if ((count & 0xFFFFFFF0U) == 0x30U) {
-            // odd reference count and drop-to-zero condition detected!
-            prv_quiesce_complete(c);
-        }
-    }
-
-
-    collector& sync(collector& c)
-    {
-        // check if the `c' is in the middle of a quiescence process.
-        if (c.count_.load(std::memory_order_relaxed) & 0x10U) {
-            // drop `c' and get the next collector.
-            release(c);
-    
-            return acquire();
-        }
-    
-        return c;
-    }
-
-
-    void collect()
-    {
-        prv_quiesce_begin();
-    }
-
-
-    void collect(collector& c, node* n)
-    {
-        if (! n) return;
-        
-        // link node into the defer list.
-        node* prev = c.defer_.exchange(n, std::memory_order_relaxed);
-        n->defer_next_ = prev;
-        
-        // bump the defer count and begin quiescence process if over
-        // the limit.
-        unsigned int count =
-        c.defer_count_.fetch_add(1, std::memory_order_relaxed) + 1;
-        
-        if (count >= (T_defer_limit / 2))
-        {
-            prv_quiesce_begin();
-        }
-    }
-};
-
-
-
-
-// you're basic lock-free stack...
-// well, minus ABA counter and DWCAS of course! ;^)
-class stack
-{
-    std::atomic<node*> head_;
-
-public:
-    stack() : head_(nullptr) {}
-
-    void push(node* n)
-    {
-        node* head = head_.load(std::memory_order_relaxed);
-        do
-        {
-            n->next_.store(head, std::memory_order_relaxed);
-        } while (! head_.compare_exchange_weak(head, n, std::memory_order_release));
-    }
-    
-    
-    node* flush()
-    {
-        return head_.exchange(NULL, std::memory_order_acquire);
-    }
-    
-    
-    node* get_head()
-    {
-        return head_.load(std::memory_order_acquire);
-    }
-    
-    node* pop()
-    {
-        node* head = head_.load(std::memory_order_acquire);
-        node* xchg;
-        
-        do
-        {
-            if (! head) return nullptr;
-            xchg = head->next_.load(std::memory_order_relaxed);
-        } while (! head_.compare_exchange_weak(head, xchg, std::memory_order_acquire));
-        
-        return head;
-    }
-};
+#include "proxy.h"
+#include "stack.h"
+#include "reaper.h"
+#include "../epoch_reclamation/epoch_reclamation.h"
 
 #define ITERS 150000
 #define DEFER 6
 #define WRITERS 3
 #define READERS 5
-#define REAPERS 2
-#define THREADS (WRITERS + READERS + REAPERS)
+#define THREADS (WRITERS + READERS)
 
 
-typedef proxy<DEFER, 4> proxy_type;
+typedef proxy<DEFER, 4, node> proxy_type;
+typedef proxy<256, 4, node> scaling_proxy;
 
 proxy_type g_proxy;
 stack g_stack;
@@ -264,61 +47,139 @@ std::atomic<unsigned> g_writers{WRITERS}; // for proper test termination only.
 void thread_func(size_t tidx)
 {
     if (tidx < READERS) {
-        proxy_type::collector* c = &g_proxy.acquire();
+        proxy_type::reader r(g_proxy);
    
         // readers.
         while (g_writers)
         {
-   
-            node* n = g_stack.get_head();
-   
-            while (n)
             {
-                node* next = n->next_.load(std::memory_order_relaxed);
-                n = next;
+                proxy_type::read_guard g(r);
+       
+                node* n = g_stack.get_head();
+       
+                while (n)
+                {
+                    node* next = n->next_.load(std::memory_order_relaxed);
+                    n = next;
+                }
             }
    
-            c = &g_proxy.sync(*c);
-   
             std::this_thread::yield();
         }
-        g_proxy.release(*c);
    
     } else if (tidx < WRITERS + READERS) {
         // writers.
+        proxy_type::reader r(g_proxy);
         unsigned count = 0;
    
         for (unsigned int i = 0; i < ITERS; ++i) {
             g_stack.push(new node);
        
             if (! (i % 2)) {
-                proxy_type::collector& c = g_proxy.acquire();
-                g_proxy.collect(c, g_stack.pop());
-                g_proxy.release(c);
+                {
+                    proxy_type::read_guard g(r);
+                    g.collect(g_stack.pop());
+                }
                 std::this_thread::yield();
             }
         }
        
         for (unsigned int i = count; i < ITERS; ++i)
         {
-            proxy_type::collector& c = g_proxy.acquire();
-            g_proxy.collect(c, g_stack.pop());
-            g_proxy.release(c);
+            proxy_type::read_guard g(r);
+            g.collect(g_stack.pop());
         }
+        r.offline();
         --g_writers;
-       
-    } else if (tidx < WRITERS + READERS + REAPERS) {
-        // reapers.
-        while (g_writers)
+    }
+}
+
+static inline uint64_t rdtsc() {
+    uint64_t lo, hi;
+    __asm__ volatile ("rdtsc"
+            : "=a" (lo), "=d"(hi) /*outputs */
+            : /* no input parameters */
+            : "%ebx", "%ecx", "memory"); /* clobbers */
+    return lo | (hi << 32);
+}
+
+#define SCALING_READS 200000
+#define SCALING_MAX_READERS 64
+
+static void free_scaling_node(defer_node* n)
+{
+    delete static_cast<node*>(n);
+}
+
+// read-side entry/exit cost as readers are added: every read is one guard
+// around a look at the stack head, one writer keeps retiring nodes. the
+// result is per read on one core, so flat means the read side scales.
+// every reader builds a handle_t from the domain and a guard_t from that,
+// either the domain itself or a per-thread proxy<>::reader.
+template<typename domain_t, typename handle_t = domain_t&,
+         typename guard_t = typename domain_t::guard>
+static uint64_t reader_scaling(size_t readers)
+{
+    domain_t domain;
+    stack s;
+    std::atomic<size_t> running{readers};
+    std::atomic<bool> go{false};
+
+    std::thread writer([&] {
+        while (running.load(std::memory_order_relaxed))
         {
-            g_proxy.collect();
+            s.push(new node);
+            typename domain_t::guard g(domain);
+            if (node* n = s.pop(g)) {
+                g.retire(n, &free_scaling_node);
+            }
             std::this_thread::yield();
         }
+    });
+
+    std::vector<std::thread> threads;
+    for (size_t i = 0; i < readers; ++i) {
+        threads.push_back(std::thread([&] {
+            while (! go.load(std::memory_order_relaxed)) {
+                std::this_thread::yield();
+            }
+            handle_t h(domain);
+            for (unsigned r = 0; r < SCALING_READS; ++r)
+            {
+                guard_t g(h);
+                if (node* n = s.peek(g)) {
+                    n->next_.load(std::memory_order_relaxed);
+                }
+            }
+            running.fetch_sub(1, std::memory_order_relaxed);
+        }));
+    }
+
+    uint64_t start = rdtsc();
+    go = true;
+    for (size_t i = 0; i < readers; ++i) {
+        threads[i].join();
     }
+    uint64_t end = rdtsc();
+    writer.join();
+
+    while (node* n = s.pop()) {
+        delete n;
+    }
+
+    size_t cores = std::thread::hardware_concurrency();
+    size_t busy = (cores && cores < readers) ? cores : readers;
+    return (end - start) * busy / (readers * SCALING_READS);
 }
 
 int main()
 {
+    // reclamation runs in the background instead of on spinning threads.
+    proxy_reaper<proxy_type>::options options;
+    options.min_interval = std::chrono::microseconds(200);
+    options.wake_count = DEFER / 2;
+    proxy_reaper<proxy_type>* reaper = new proxy_reaper<proxy_type>(g_proxy, options);
+    
     std::array<std::thread, THREADS> threads;
     for (size_t i = 0; i < THREADS; ++i) {
         threads[i] = std::move(std::thread(thread_func, i));
@@ -329,6 +190,21 @@ int main()
     for (size_t i = 0; i < THREADS; ++i) {
         threads[i].join();
     }
+    
+    std::cout << "reaper rounds=" << reaper->rounds()
+        << " reclaim lag last=" << reaper->reclaim_lag().count() / 1000
+        << "us max=" << reaper->max_reclaim_lag().count() / 1000
+        << "us pending=" << g_proxy.pending() << std::endl;
+    delete reaper;
+
+    for (size_t readers = 1; readers <= SCALING_MAX_READERS; readers *= 2) {
+        std::cout << "readers=" << readers
+            << " proxy<> cycles/read=" << reader_scaling<scaling_proxy>(readers)
+            << " proxy<>::reader cycles/read="
+            << reader_scaling<scaling_proxy, scaling_proxy::reader, scaling_proxy::read_guard>(readers)
+            << " epoch cycles/read=" << reader_scaling<epoch_domain>(readers)
+            << std::endl;
+    }
 
     return 0;
 }
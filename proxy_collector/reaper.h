@@ -0,0 +1,168 @@
+#ifndef REAPER_H
+#define REAPER_H
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <mutex>
+#include <thread>
+
+/*
+ * background reaper for a proxy<>: one thread that starts the quiescence
+ * process for the proxy, instead of threads spinning on collect().
+ *
+ * it wakes every `interval', or right away when a collector's defer count
+ * reaches `wake_count' (or `wake_bytes' worth of nodes). when nothing is
+ * pending it doubles its interval up to `max_interval', so an idle proxy
+ * costs next to nothing, and drops back to `min_interval' as soon as there
+ * is work. it takes two collections for an object to be disposed of (the
+ * proxy keeps a back link), so with a steady trickle of deferrals the
+ * reclamation lag is bounded by about twice `min_interval' plus the
+ * longest read-side critical section.
+ *
+ * destroy the reaper before the proxy, and once no thread defers through
+ * the proxy any more: the wake trigger calls into the reaper.
+ */
+template<typename proxy_t, typename node_t = typename proxy_t::node_type>
+class proxy_reaper
+{
+public:
+    struct options
+    {
+        std::chrono::microseconds min_interval;
+        std::chrono::microseconds max_interval;
+        unsigned wake_count;  // 0: no count trigger
+        size_t wake_bytes;    // 0: no byte trigger
+
+        options()
+            : min_interval(std::chrono::milliseconds(1))
+            , max_interval(std::chrono::milliseconds(100))
+            , wake_count(0), wake_bytes(0) {}
+    };
+
+private:
+    proxy_t& proxy_;
+    options const options_;
+    typename proxy_t::waker waker_;
+
+    std::mutex mutex_;
+    std::condition_variable cond_;
+    bool woken_;
+    bool stop_;
+    std::atomic<uint64_t> rounds_;
+    std::atomic<int64_t> interval_;
+    std::thread thread_;
+
+    static void wake_fn(void* ctx)
+    {
+        static_cast<proxy_reaper*>(ctx)->wake();
+    }
+
+    static unsigned wake_at(options const& o)
+    {
+        size_t at = o.wake_count;
+        if (o.wake_bytes) {
+            size_t by_bytes = o.wake_bytes / sizeof(node_t);
+            if (by_bytes == 0) {
+                by_bytes = 1;
+            }
+            if (at == 0 || by_bytes < at) {
+                at = by_bytes;
+            }
+        }
+        return (unsigned)at;
+    }
+
+    void run()
+    {
+        std::chrono::microseconds interval = options_.min_interval;
+        std::unique_lock<std::mutex> lock(mutex_);
+        while (! stop_)
+        {
+            interval_.store(interval.count(), std::memory_order_relaxed);
+            cond_.wait_for(lock, interval, [this] { return woken_ || stop_; });
+            woken_ = false;
+            if (stop_) {
+                break;
+            }
+
+            lock.unlock();
+            if (proxy_.pending()) {
+                proxy_.collect();
+                rounds_.fetch_add(1, std::memory_order_relaxed);
+                interval = options_.min_interval;
+            } else if (interval < options_.max_interval) {
+                interval *= 2;
+                if (interval > options_.max_interval) {
+                    interval = options_.max_interval;
+                }
+            }
+            lock.lock();
+        }
+    }
+
+public:
+    explicit proxy_reaper(proxy_t& p, options const& o = options())
+        : proxy_(p), options_(o), woken_(false), stop_(false)
+        , rounds_(0), interval_(o.min_interval.count())
+    {
+        waker_.fn_ = &wake_fn;
+        waker_.ctx_ = this;
+        waker_.at_ = wake_at(o);
+        if (waker_.at_) {
+            proxy_.set_waker(&waker_);
+        }
+        thread_ = std::thread(&proxy_reaper::run, this);
+    }
+
+    ~proxy_reaper()
+    {
+        if (waker_.at_) {
+            proxy_.set_waker(nullptr);
+        }
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stop_ = true;
+        }
+        cond_.notify_one();
+        thread_.join();
+    }
+
+    proxy_reaper(proxy_reaper const&) = delete;
+    void operator = (proxy_reaper const&) = delete;
+
+    // run a round now rather than at the end of the interval.
+    void wake()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            woken_ = true;
+        }
+        cond_.notify_one();
+    }
+
+    // rounds that found work and started a collection.
+    uint64_t rounds() const
+    {
+        return rounds_.load(std::memory_order_relaxed);
+    }
+
+    // the current sleep, grows while the proxy is idle.
+    std::chrono::microseconds interval() const
+    {
+        return std::chrono::microseconds(interval_.load(std::memory_order_relaxed));
+    }
+
+    std::chrono::nanoseconds reclaim_lag() const
+    {
+        return proxy_.reclaim_lag();
+    }
+
+    std::chrono::nanoseconds max_reclaim_lag() const
+    {
+        return proxy_.max_reclaim_lag();
+    }
+};
+
+#endif /* end of REAPER_H */
@@ -0,0 +1,106 @@
+/*
+ * Word-Based Portable Proxy Garbage Collector
+ * Copyright (C) 2010 Christopher Michael Thomasson
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef STACK_H
+#define STACK_H
+
+#include <atomic>
+
+#include "../common/defer_node.h"
+
+struct node : defer_node
+{
+    std::atomic<node*> next_;
+};
+
+// you're basic lock-free stack...
+// well, minus ABA counter and DWCAS of course! ;^)
+class stack
+{
+    std::atomic<node*> head_;
+
+public:
+    stack() : head_(nullptr) {}
+
+    void push(node* n)
+    {
+        node* head = head_.load(std::memory_order_relaxed);
+        do
+        {
+            n->next_.store(head, std::memory_order_relaxed);
+        } while (! head_.compare_exchange_weak(head, n, std::memory_order_release));
+    }
+    
+    
+    node* flush()
+    {
+        return head_.exchange(NULL, std::memory_order_acquire);
+    }
+    
+    
+    node* get_head()
+    {
+        return head_.load(std::memory_order_acquire);
+    }
+    
+    node* pop()
+    {
+        node* head = head_.load(std::memory_order_acquire);
+        node* xchg;
+        
+        do
+        {
+            if (! head) return nullptr;
+            xchg = head->next_.load(std::memory_order_relaxed);
+        } while (! head_.compare_exchange_weak(head, xchg, std::memory_order_acquire));
+        
+        return head;
+    }
+    
+    
+    // read the head under a reclamation guard, it stays valid until the
+    // guard goes away.
+    template<typename guard_t>
+    node* peek(guard_t& g)
+    {
+        return g.protect(0, head_);
+    }
+    
+    
+    // pop under a reclamation guard (proxy<>::guard, hazard_domain::guard,
+    // ...): the head is protected before its next_ is read, and since a
+    // popped node is only reused after it was retired through the same
+    // scheme, the CAS can't fall for ABA either.
+    template<typename guard_t>
+    node* pop(guard_t& g)
+    {
+        node* head;
+        node* xchg;
+        
+        do
+        {
+            head = g.protect(0, head_);
+            if (! head) return nullptr;
+            xchg = head->next_.load(std::memory_order_relaxed);
+        } while (! head_.compare_exchange_weak(head, xchg, std::memory_order_acquire));
+        
+        return head;
+    }
+};
+
+#endif /* end of STACK_H */
@@ -0,0 +1,87 @@
+/*
+ * push/pop pairs on the stacks, 1 to 64 threads.
+ *
+ *     stack                 stack.h, plain head CAS, no ABA protection
+ *     tagged                elimination_stack<node, 0>, tagged head only
+ *     elimination           elimination_stack<node>, tagged head and an
+ *                           elimination array
+ *
+ * every thread owns a few nodes and pops whatever is on top before pushing
+ * one of its own back, so nodes stay mapped for the whole run. prints
+ * cycles per operation on one core, flat means the stack scales.
+ */
+
+#include <atomic>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+#include "stack.h"
+#include "elimination_stack.h"
+
+#define OPS 2000000
+#define NODES_PER_THREAD 16
+#define MAX_THREADS 64
+
+static std::atomic<bool> g_start{false};
+
+static inline uint64_t rdtsc() {
+    uint64_t lo, hi;
+    __asm__ volatile ("rdtsc"
+            : "=a" (lo), "=d"(hi) /*outputs */
+            : /* no input parameters */
+            : "%ebx", "%ecx", "memory"); /* clobbers */
+    return lo | (hi << 32);
+}
+
+template<typename stack_t>
+static void thread_func(stack_t& s, size_t pairs) {
+    while (!g_start.load(std::memory_order_relaxed)) {
+        std::this_thread::yield();
+    }
+    for (size_t i = 0; i != pairs; ++i) {
+        node* n = s.pop();
+        if (n) {
+            s.push(n);
+        }
+    }
+}
+
+template<typename stack_t>
+static uint64_t run(size_t threads) {
+    stack_t s;
+    std::vector<node> nodes(threads * NODES_PER_THREAD);
+    for (size_t i = 0; i != nodes.size(); ++i) {
+        s.push(&nodes[i]);
+    }
+
+    size_t pairs = OPS / 2 / threads;
+    g_start = false;
+    std::vector<std::thread> workers;
+    for (size_t i = 0; i != threads; ++i) {
+        workers.push_back(std::thread(thread_func<stack_t>, std::ref(s), pairs));
+    }
+
+    uint64_t start = rdtsc();
+    g_start = true;
+    for (size_t i = 0; i != threads; ++i) {
+        workers[i].join();
+    }
+    uint64_t end = rdtsc();
+
+    s.flush();
+    size_t cores = std::thread::hardware_concurrency();
+    size_t busy = (cores && cores < threads) ? cores : threads;
+    return (end - start) * busy / (pairs * 2 * threads);
+}
+
+int main() {
+    for (size_t threads = 1; threads <= MAX_THREADS; threads *= 2) {
+        std::cout << "threads=" << threads
+            << " stack cycles/op=" << run<stack>(threads)
+            << " tagged cycles/op=" << run<elimination_stack<node, 0> >(threads)
+            << " elimination cycles/op=" << run<elimination_stack<node> >(threads)
+            << std::endl;
+    }
+    return 0;
+}
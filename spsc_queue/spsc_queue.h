@@ -0,0 +1,256 @@
+#ifndef SPSC_QUEUE_H
+#define SPSC_QUEUE_H
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+
+#include "../common/prefetch.h"
+
+#define cache_line_size 64
+
+/*
+ * alloc_t allocates the nodes and is rebound to the node type. any
+ * std::allocator-compatible allocator works, stateful ones (a pmr
+ * polymorphic_allocator, arena_allocator from ../common/node_arena.h)
+ * included: pass it to the constructor. pool_allocator<T> from
+ * ../common/node_pool.h shares nodes between queues. the queue caches its
+ * nodes itself, the allocator only sees the growth and the final
+ * teardown, always from the producer or the destructor.
+ *
+ * T_prefetch makes dequeue and dequeue_bulk prefetch the node after the
+ * one they return (../common/prefetch.h), for deep queues whose nodes are
+ * scattered over the heap.
+ *
+ * reserve(n) puts n more nodes into the cache up front, so the first burst
+ * neither allocates nor faults in fresh pages; in strict mode enqueue never
+ * allocates and fails instead when the cache is empty. both are producer
+ * side, like close().
+ */
+template <typename T, typename alloc_t = std::allocator<T>, bool T_prefetch = false>
+class spsc_queue
+{
+public:
+    struct node
+    {
+        std::atomic<node *> next_;
+        T value_;
+        node(T value, node *next = nullptr) : value_(value)
+        {
+            next_.store(next, std::memory_order_relaxed);
+        }
+    };
+
+    typedef node node_type;
+
+    explicit spsc_queue(alloc_t const& alloc = alloc_t())
+        : alloc_(alloc), enqueued_(0), closed_(false), strict_(false), dequeued_(0)
+    {
+        node *n = new_node(T());
+        tail_ = head_ = first_ = tail_copy_ = n;
+    }
+
+    ~spsc_queue()
+    {
+        node *n = first_;
+        do {
+            node *next = n->next_;
+            delete_node(n);
+            n = next;
+        } while (n);
+    }
+
+    bool enqueue(T v)
+    {
+        if (closed_.load(std::memory_order_relaxed)) {
+            return false;
+        }
+        node *n = alloc_node(v);
+        if (!n) {
+            return false;
+        }
+        n->next_ = nullptr;
+
+        /*
+         * when head_->next_ == tail_->next
+         * synchronize with tail_->next
+         */
+        node *head = head_.load(std::memory_order_relaxed);
+        head->next_.store(n, std::memory_order_release); // 1. synchronize with consumer
+        head_ = n;
+        enqueued_.store(enqueued_.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        return true;
+    }
+
+    bool dequeue(T &v)
+    {
+        /*
+         * when head_->next_ == tail_->next
+         * synchronize with tail_->next
+         */
+        node *tail = tail_.load(std::memory_order_relaxed);
+        node *tail_next = tail->next_.load(std::memory_order_consume); // 1. synchronize with producer
+
+        if (tail_next) {
+            if (T_prefetch) {
+                prefetch_node(tail_next->next_.load(std::memory_order_relaxed));
+            }
+            v = tail_next->value_;
+            // synchronize with tail_copy_ load in alloc_node
+            tail_.store(tail_next, std::memory_order_release); // 2. synchronize with alloc_node
+            dequeued_.store(dequeued_.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+            return true;
+        }
+        return false;
+    }
+
+    // dequeue up to `max' elements into `values', returns how many. tail_
+    // and the counter are published once for the whole batch.
+    size_t dequeue_bulk(T *values, size_t max)
+    {
+        node *tail = tail_.load(std::memory_order_relaxed);
+        size_t count = 0;
+        while (count != max) {
+            node *tail_next = tail->next_.load(std::memory_order_consume); // 1. synchronize with producer
+            if (!tail_next) {
+                break;
+            }
+            if (T_prefetch) {
+                prefetch_node(tail_next->next_.load(std::memory_order_relaxed));
+            }
+            values[count++] = tail_next->value_;
+            tail = tail_next;
+        }
+        if (count) {
+            tail_.store(tail, std::memory_order_release); // 2. synchronize with alloc_node
+            dequeued_.store(dequeued_.load(std::memory_order_relaxed) + count, std::memory_order_relaxed);
+        }
+        return count;
+    }
+
+    // wait-free depth hint, callable from any thread. each counter has a
+    // single writer, so there is no RMW on either side.
+    size_t size_approx() const
+    {
+        size_t deq = dequeued_.load(std::memory_order_relaxed);
+        size_t enq = enqueued_.load(std::memory_order_relaxed);
+        return enq > deq ? enq - deq : 0;
+    }
+
+    bool empty() const
+    {
+        return size_approx() == 0;
+    }
+
+    // link `n' fresh nodes into the cache, in front of the ones the
+    // consumer has handed back. the nodes are written, so their pages are
+    // faulted in here.
+    void reserve(size_t n)
+    {
+        node *first = first_.load(std::memory_order_relaxed);
+        for (size_t i = 0; i != n; ++i) {
+            node *c = new_node(T());
+            c->next_.store(first, std::memory_order_relaxed);
+            first = c;
+        }
+        first_.store(first, std::memory_order_relaxed);
+    }
+
+    // in strict mode enqueue only takes cached nodes and returns false when
+    // there is none.
+    void set_strict(bool strict)
+    {
+        strict_ = strict;
+    }
+
+    // O(1) shutdown. closed_ is producer state like head_, so call this
+    // from the producer thread (or once the producer is gone); enqueues
+    // fail from then on and the consumer drains what is left.
+    void close()
+    {
+        closed_.store(true, std::memory_order_release);
+    }
+
+    bool is_closed() const
+    {
+        return closed_.load(std::memory_order_acquire);
+    }
+
+    // true once the queue is closed and everything in it has been
+    // dequeued. it stays true.
+    bool closed() const
+    {
+        return closed_.load(std::memory_order_acquire) &&
+            dequeued_.load(std::memory_order_relaxed) == enqueued_.load(std::memory_order_relaxed);
+    }
+private:
+    typedef typename std::allocator_traits<alloc_t>::template rebind_alloc<node> node_alloc_t;
+    typedef std::allocator_traits<node_alloc_t> node_traits;
+
+    node *new_node(T v)
+    {
+        node *n = node_traits::allocate(alloc_, 1);
+        node_traits::construct(alloc_, n, v);
+        return n;
+    }
+
+    void delete_node(node *n)
+    {
+        node_traits::destroy(alloc_, n);
+        node_traits::deallocate(alloc_, n, 1);
+    }
+
+    // producer part
+    node_alloc_t alloc_;
+    std::atomic<node *> head_; // head of the queue
+    std::atomic<node *> first_; // last unused node (tail of node cache)
+    std::atomic<node *> tail_copy_; // helper node try to catch up tail_ (between first_ and tail_)
+    std::atomic<size_t> enqueued_; // written by producer only
+    std::atomic<bool> closed_; // written by producer only
+    bool strict_; // never allocate in enqueue
+
+    char cache_line_padding_[cache_line_size];
+
+    // consumer part
+    std::atomic<node *> tail_; // tail of the queue
+    std::atomic<size_t> dequeued_; // written by consumer only
+
+    spsc_queue(spsc_queue const&) = delete;
+    spsc_queue& operator = (spsc_queue const&) = delete;
+
+public:
+
+    node *alloc_node(T v)
+    {
+        // first tries to allocate node from internal node cache,
+        // if attempt fails, allocates node via alloc_t (nullptr in strict
+        // mode)
+
+        node *first = first_.load(std::memory_order_relaxed);
+        node *tail_copy = tail_copy_.load(std::memory_order_relaxed);
+
+        if (first != tail_copy) {
+            node *n = first;
+            n->value_ = v;
+            first_.store(first->next_, std::memory_order_relaxed);
+            return n;
+        }
+
+        tail_copy_ = tail_.load(std::memory_order_consume); // 2. synchronize with consumer
+
+        if (first != tail_copy_) {
+            node *n = first;
+            n->value_ = v;
+            first_.store(first->next_, std::memory_order_relaxed);
+            return n;
+        }
+
+        if (strict_) {
+            return nullptr;
+        }
+        node *n = new_node(v);
+        return n;
+    }
+};
+
+#endif /* end of SPSC_QUEUE_H */
@@ -0,0 +1,178 @@
+#ifndef SPSC_UNROLLED_QUEUE_H
+#define SPSC_UNROLLED_QUEUE_H
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+
+#define cache_line_size 64
+
+/*
+ * spsc_queue with unrolled nodes: every node holds T_slots values and a
+ * fill index, and the producer links a new node only every T_slots
+ * elements. within a node the producer stores the value and then bumps
+ * filled_ with a release store, the consumer reads up to filled_, so for
+ * a small T the queue walks memory like an array while staying unbounded.
+ *
+ * nodes the consumer has left are recycled by the producer exactly like
+ * in spsc_queue (first_ .. tail_copy_ .. tail_), alloc_t only sees the
+ * growth and the final teardown.
+ */
+template <typename T, size_t T_slots = 16, typename alloc_t = std::allocator<T> >
+class spsc_unrolled_queue
+{
+    static_assert(T_slots > 0, "a node holds at least one value");
+
+public:
+    struct node
+    {
+        std::atomic<node *> next_;
+        std::atomic<size_t> filled_;
+        T values_[T_slots];
+        node() : next_(nullptr), filled_(0) {}
+    };
+
+    typedef node node_type;
+
+    explicit spsc_unrolled_queue(alloc_t const& alloc = alloc_t())
+        : alloc_(alloc), written_(0), enqueued_(0), closed_(false)
+        , read_(0), dequeued_(0)
+    {
+        node *n = new_node();
+        tail_ = head_ = first_ = tail_copy_ = n;
+    }
+
+    ~spsc_unrolled_queue()
+    {
+        node *n = first_;
+        do {
+            node *next = n->next_;
+            delete_node(n);
+            n = next;
+        } while (n);
+    }
+
+    spsc_unrolled_queue(spsc_unrolled_queue const&) = delete;
+    spsc_unrolled_queue& operator = (spsc_unrolled_queue const&) = delete;
+
+    bool enqueue(T const& v)
+    {
+        if (closed_.load(std::memory_order_relaxed)) {
+            return false;
+        }
+        node *head = head_.load(std::memory_order_relaxed);
+        if (written_ == T_slots) {
+            node *n = alloc_node();
+            head->next_.store(n, std::memory_order_release); // synchronize with consumer
+            head_.store(n, std::memory_order_relaxed);
+            head = n;
+            written_ = 0;
+        }
+        head->values_[written_] = v;
+        head->filled_.store(++written_, std::memory_order_release); // synchronize with consumer
+        enqueued_.store(enqueued_.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        return true;
+    }
+
+    bool dequeue(T &v)
+    {
+        node *tail = tail_.load(std::memory_order_relaxed);
+        if (read_ == T_slots) {
+            node *next = tail->next_.load(std::memory_order_acquire); // synchronize with producer
+            if (!next) {
+                return false;
+            }
+            // hands the finished node to the producer's cache.
+            tail_.store(next, std::memory_order_release);
+            tail = next;
+            read_ = 0;
+        }
+        if (read_ == tail->filled_.load(std::memory_order_acquire)) { // synchronize with producer
+            return false;
+        }
+        v = tail->values_[read_++];
+        dequeued_.store(dequeued_.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        return true;
+    }
+
+    size_t size_approx() const
+    {
+        size_t deq = dequeued_.load(std::memory_order_relaxed);
+        size_t enq = enqueued_.load(std::memory_order_relaxed);
+        return enq > deq ? enq - deq : 0;
+    }
+
+    bool empty() const
+    {
+        return size_approx() == 0;
+    }
+
+    // producer side, like spsc_queue::close().
+    void close()
+    {
+        closed_.store(true, std::memory_order_release);
+    }
+
+    bool is_closed() const
+    {
+        return closed_.load(std::memory_order_acquire);
+    }
+
+    bool closed() const
+    {
+        return closed_.load(std::memory_order_acquire) &&
+            dequeued_.load(std::memory_order_relaxed) == enqueued_.load(std::memory_order_relaxed);
+    }
+
+private:
+    typedef typename std::allocator_traits<alloc_t>::template rebind_alloc<node> node_alloc_t;
+    typedef std::allocator_traits<node_alloc_t> node_traits;
+
+    node *new_node()
+    {
+        node *n = node_traits::allocate(alloc_, 1);
+        node_traits::construct(alloc_, n);
+        return n;
+    }
+
+    void delete_node(node *n)
+    {
+        node_traits::destroy(alloc_, n);
+        node_traits::deallocate(alloc_, n, 1);
+    }
+
+    // a cached node if the consumer has left one behind, a new one
+    // otherwise; either way empty and unlinked.
+    node *alloc_node()
+    {
+        node *first = first_.load(std::memory_order_relaxed);
+        if (first == tail_copy_.load(std::memory_order_relaxed)) {
+            tail_copy_.store(tail_.load(std::memory_order_acquire), std::memory_order_relaxed); // synchronize with consumer
+            if (first == tail_copy_.load(std::memory_order_relaxed)) {
+                return new_node();
+            }
+        }
+        first_.store(first->next_.load(std::memory_order_relaxed), std::memory_order_relaxed);
+        first->next_.store(nullptr, std::memory_order_relaxed);
+        first->filled_.store(0, std::memory_order_relaxed);
+        return first;
+    }
+
+    // producer part
+    node_alloc_t alloc_;
+    std::atomic<node *> head_;
+    std::atomic<node *> first_; // oldest cached node
+    std::atomic<node *> tail_copy_; // producer's copy of tail_
+    size_t written_; // slots used in head_
+    std::atomic<size_t> enqueued_;
+    std::atomic<bool> closed_;
+
+    char cache_line_padding_[cache_line_size];
+
+    // consumer part
+    std::atomic<node *> tail_;
+    size_t read_; // slots consumed in tail_
+    std::atomic<size_t> dequeued_;
+};
+
+#endif /* end of SPSC_UNROLLED_QUEUE_H */